@@ -3,6 +3,10 @@
 #include <X11/extensions/shape.h>
 #include <X11/extensions/Xrender.h>
 #include <X11/Xft/Xft.h>
+#include <ft2build.h>
+#include <freetype2/freetype/freetype.h>
+#include <fontconfig/fontconfig.h>
+#include <fontconfig/fcfreetype.h>
 #include <locale.h>
 #include <string.h>
 #include <stdio.h>
@@ -10,14 +14,114 @@
 #include <time.h>
 #include <math.h>
 #include <errno.h>
-#include <semaphore.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <dbus/dbus.h>
 #include <X11/extensions/Xinerama.h>
+#include <X11/extensions/Xrandr.h>
 
-static void nsleep(long ns) {
-  struct timespec req = { ns / 1000000000L, ns % 1000000000L };
-  while (nanosleep(&req, &req) == -1) {}
+#include "verdana.ttf.h"
+#include "x11notif_ring.h"
+
+/* Wire format shared with x11power: one SOCK_SEQPACKET packet per message,
+ * a NotifWireHeader followed by `len` bytes of UTF-8 text (no NUL). */
+#define NOTIF_WIRE_MAGIC 0x4e58 // "XN"
+#define NOTIF_WIRE_VERSION 1
+#define NOTIF_TEXT_MAX 512
+
+#define DEFAULT_HOLD_MS 2000
+#define STACK_MAX 8  // rows of notifications on screen at once
+#define STACK_GAP 8  // pixels between rows
+
+typedef struct {
+  uint16_t magic;
+  uint8_t version;
+  uint8_t urgency; // 0 normal, 1 critical
+  uint32_t len;
+} NotifWireHeader;
+
+/* Version 2 packets carry an OSD header instead: a later packet with the
+ * same replace_id updates the notification in place, and value (0..100,
+ * -1 for none) is drawn as a bar. */
+#define NOTIF_WIRE_VERSION_OSD 2
+
+typedef struct {
+  NotifWireHeader h;
+  uint32_t replace_id;
+  int32_t value;
+} NotifWireOsd;
+
+static int64_t mono_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void sleep_until_ns(int64_t deadline) {
+  struct timespec ts = { (time_t)(deadline / 1000000000LL), (long)(deadline % 1000000000LL) };
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+}
+
+/* How late each animation frame woke up relative to its deadline. */
+typedef struct {
+  unsigned long frames, dropped;
+  double sum_us, sumsq_us, max_us;
+} FrameStats;
+
+static FrameStats frame_stats;
+static int print_stats; // --stats: dump after every notification
+
+static void frame_stats_record(int64_t late_ns, int64_t missed) {
+  double us = (double)late_ns / 1000.0;
+  ++frame_stats.frames;
+  frame_stats.dropped += (unsigned long)missed;
+  frame_stats.sum_us += us;
+  frame_stats.sumsq_us += us * us;
+  if (us > frame_stats.max_us) frame_stats.max_us = us;
+}
+
+static void frame_stats_dump(FILE *f) {
+  const FrameStats *s = &frame_stats;
+  if (!s->frames) {
+    fprintf(f, "x11notif: no frames yet\n");
+    return;
+  }
+  double mean = s->sum_us / (double)s->frames;
+  double var = s->sumsq_us / (double)s->frames - mean * mean;
+  fprintf(f, "x11notif: %lu frames, %lu dropped, lateness mean %.0f us, jitter %.0f us, max %.0f us\n",
+          s->frames, s->dropped, mean, sqrt(var > 0 ? var : 0), s->max_us);
+}
+
+/* Startup phases of the process, printed to stderr when X11NOTIF_TIMING is
+ * set. Each line is the time since the previous mark; the last one is
+ * time-to-first-pixel, taken after a round trip once the first slide-in
+ * frame has put part of a window on screen. */
+#define TIMING_MAX 12
+
+static struct { const char *what; int64_t at; } timing[TIMING_MAX];
+static int ntiming = -1; // -1: not timing
+
+static void timing_mark(const char *what) {
+  if (ntiming < 0 || ntiming >= TIMING_MAX) return;
+  timing[ntiming].what = what;
+  timing[ntiming++].at = mono_ns();
+}
+
+static void timing_first_pixel(Display *dpy) {
+  if (ntiming < 0) return;
+  XSync(dpy, False);
+  timing_mark("first pixel");
+  for (int i = 1; i < ntiming; ++i)
+    fprintf(stderr, "x11notif: %-12s %8.2f ms\n", timing[i].what, (double)(timing[i].at - timing[i - 1].at) / 1e6);
+  fprintf(stderr, "x11notif: %-12s %8.2f ms\n", "total", (double)(timing[ntiming - 1].at - timing[0].at) / 1e6);
+  ntiming = -1; // once per process
 }
 
 static Region make_parallelogram_region(int w, int h, int slant) {
@@ -52,14 +156,12 @@ static Picture linear_grad(Display *dpy, double x1, double y1, double x2, double
   XLinearGradient grad;
   grad.p1.x = XDoubleToFixed(x1); grad.p1.y = XDoubleToFixed(y1);
   grad.p2.x = XDoubleToFixed(x2); grad.p2.y = XDoubleToFixed(y2);
-  XFixed *stops = (XFixed*)calloc((size_t)n, sizeof(XFixed));
+  XFixed stops[8]; // callers use at most 5
   for (int i = 0; i < n; ++i) stops[i] = XDoubleToFixed(ofs[i]);
-  Picture p = XRenderCreateLinearGradient(dpy, &grad, stops, (XRenderColor*)cols, n);
-  free(stops);
-  return p;
+  return XRenderCreateLinearGradient(dpy, &grad, stops, (XRenderColor*)cols, n);
 }
 
-static void paint_background(Display *dpy, Window win, int screen, int w, int h) {
+static void paint_background(Display *dpy, Drawable win, int screen, int w, int h) {
   // Colors from spec
   const unsigned char dl_r=0x13, dl_g=0x16, dl_b=0x34; // #131634
   const unsigned char pu_r=0x60, pu_g=0x60, pu_b=0x9a; // #60609a
@@ -147,238 +249,1584 @@ static void paint_background(Display *dpy, Window win, int screen, int w, int h)
   XRenderFreePicture(dpy, dst);
 }
 
-static void draw_notification(Display *dpy, Window win, int w, int h, int slant, const char *msg, const char *fontname) {
-  int screen = DefaultScreen(dpy);
-  GC gc = XCreateGC(dpy, win, 0, NULL);
-
-  paint_background(dpy, win, screen, w, h);
-
-  XColor col_scr, col_accent;
-  Colormap cmap = DefaultColormap(dpy, screen);
-  XAllocNamedColor(dpy, cmap, "#131634", &col_accent, &col_scr);
+/* A fully rendered notification. Installed as the window background, so
+ * exposes and repaints are handled by the server without client drawing.
+ * In ARGB mode a 32-bit copy cut to the parallelogram is composited
+ * into the stationary window instead. */
+typedef struct {
+  Pixmap pm;
+  Pixmap argb_pm;
+  Picture argb_pic; // None until first shown in ARGB mode
+  int w, h;
+  unsigned long used; // LRU stamp
+  char msg[NOTIF_TEXT_MAX + 1];
+} Surface;
 
-  int stripe_w = slant / 2; if (stripe_w < 10) stripe_w = 10;
-  draw_slanted_stripe(dpy, win, gc, w, h, slant, stripe_w, col_accent.pixel);
+/* Everything that outlives one notification: the X connection, monitor
+ * layout, pre-shaped windows, font and colours. The CLI sets it up for a
+ * single message, the daemon once. There is a window for every row
+ * (slot) on every monitor, indexed slot * nmon + monitor. */
+typedef struct {
+  Display *dpy;
+  int screen;
+  XineramaScreenInfo *mons;
+  int nmon;
+  int mons_from_xinerama;
+  int nslot;
+  Window *wins;
+  int argb;          // stationary 32-bit windows under a compositor
+  Visual *argb_vis;
+  Colormap argb_cmap;
+  XRenderPictFormat *argb_fmt;
+  Picture *win_pics; // ARGB: each window as a render target
+  Picture *cur_pics; // ARGB: the surface each window is showing
+  int *offsets;      // ARGB: where that surface is drawn, relative to the window
+  Pixmap *live_pms;  // OSD: per-window copy of the surface with the bar drawn in
+  Picture *live_pics;
+  int64_t *period_ns; // frame period of each monitor
+  int64_t *next_ns;   // next frame deadline of each window while animating
+  GC gc;
+  XftDraw *draw; // retargeted at whichever surface is being rendered
+  Surface *surfaces;
+  int nsurf;
+  unsigned long surface_clock;
+  XftFont *font;
+  FT_Library ft_lib; // set when font is the embedded one
+  FT_Face ft_face;
+  XftColor fg, shadow;
+  unsigned long accent;
+  int h, slant, margin_y;
+} Notifier;
 
-  XftDraw *draw = XftDrawCreate(dpy, win, DefaultVisual(dpy, screen), cmap);
-  XftColor xft_fg, xft_shadow;
-  XRenderColor xr_fg = { 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF }; // white
-  XRenderColor xr_shadow = { 0x0000, 0x0000, 0x0000, 0x7FFF }; // semi black
+static void draw_notification(Notifier *n, Pixmap pm, int w, const char *msg) {
+  Display *dpy = n->dpy;
+  int h = n->h, slant = n->slant;
 
-  XftColorAllocValue(dpy, DefaultVisual(dpy, screen), cmap, &xr_shadow, &xft_shadow);
-  XftColorAllocValue(dpy, DefaultVisual(dpy, screen), cmap, &xr_fg, &xft_fg);
+  paint_background(dpy, pm, n->screen, w, h);
 
-  XftFont *font = XftFontOpenName(dpy, screen, fontname ? fontname : "Sans:bold:pixelsize=20");
-  if (!font) font = XftFontOpenName(dpy, screen, "Sans:pixelsize=20");
+  int stripe_w = slant / 2; if (stripe_w < 10) stripe_w = 10;
+  draw_slanted_stripe(dpy, pm, n->gc, w, h, slant, stripe_w, n->accent);
 
   XGlyphInfo ext;
-  XftTextExtentsUtf8(dpy, font, (const FcChar8*)msg, (int)strlen(msg), &ext);
+  XftTextExtentsUtf8(dpy, n->font, (const FcChar8*)msg, (int)strlen(msg), &ext);
 
   int padding = 48;
   int text_x = stripe_w + padding + slant / 6;
   if (text_x + (int)ext.width > w - padding) text_x = w - padding - (int)ext.width;
   if (text_x < padding) text_x = padding;
 
-  int baseline = (h + font->ascent - font->descent) / 2;
+  int baseline = (h + n->font->ascent - n->font->descent) / 2;
 
-  XftDrawStringUtf8(draw, &xft_shadow, font, text_x + 1, baseline + 1, (const FcChar8*)msg, (int)strlen(msg));
-  XftDrawStringUtf8(draw, &xft_fg, font, text_x, baseline, (const FcChar8*)msg, (int)strlen(msg));
+  XftDrawChange(n->draw, pm);
+  XftDrawStringUtf8(n->draw, &n->shadow, n->font, text_x + 1, baseline + 1, (const FcChar8*)msg, (int)strlen(msg));
+  XftDrawStringUtf8(n->draw, &n->fg, n->font, text_x, baseline, (const FcChar8*)msg, (int)strlen(msg));
+}
 
-  XftFontClose(dpy, font);
-  XftColorFree(dpy, DefaultVisual(dpy, screen), cmap, &xft_fg);
-  XftColorFree(dpy, DefaultVisual(dpy, screen), cmap, &xft_shadow);
-  XftDrawDestroy(draw);
+static void surface_free(Notifier *n, Surface *s) {
+  if (s->argb_pic) XRenderFreePicture(n->dpy, s->argb_pic);
+  if (s->argb_pm) XFreePixmap(n->dpy, s->argb_pm);
+  if (s->pm) XFreePixmap(n->dpy, s->pm);
+  s->argb_pic = None;
+  s->argb_pm = s->pm = None;
+}
 
-  XFreeGC(dpy, gc);
+/* an ARGB picture a window is still compositing from can't be freed */
+static int surface_busy(const Notifier *n, const Surface *s) {
+  if (!n->argb || !s->argb_pic) return 0;
+  for (int k = 0; k < n->nslot * n->nmon; ++k)
+    if (n->cur_pics[k] == s->argb_pic) return 1;
+  return 0;
 }
 
-int main(int argc, char **argv) {
-  setlocale(LC_ALL, "");
+/* the surface for a monitor of width w, rendered on first use */
+static Surface *notifier_surface(Notifier *n, int w, const char *msg) {
+  Surface *victim = NULL;
+  for (int i = 0; i < n->nsurf; ++i) {
+    Surface *s = &n->surfaces[i];
+    if (s->pm && s->w == w && s->h == n->h && strcmp(s->msg, msg) == 0) {
+      s->used = ++n->surface_clock;
+      return s;
+    }
+    if (surface_busy(n, s)) continue;
+    if (!victim || !s->pm || (victim->pm && s->used < victim->used)) victim = s;
+  }
+  // windows still showing an evicted pixmap keep their own reference
+  surface_free(n, victim);
+  victim->pm = XCreatePixmap(n->dpy, RootWindow(n->dpy, n->screen), (unsigned)w, (unsigned)n->h,
+                             (unsigned)DefaultDepth(n->dpy, n->screen));
+  victim->w = w;
+  victim->h = n->h;
+  victim->used = ++n->surface_clock;
+  snprintf(victim->msg, sizeof victim->msg, "%s", msg);
+  draw_notification(n, victim->pm, w, msg);
+  return victim;
+}
 
-  const char *msg = (argc >= 2) ? argv[1] : "Hello, world!";
-  const char *fontname = getenv("X11NOTIF_FONT");
+/* 32-bit copy of a surface, transparent outside the parallelogram */
+static Picture surface_argb(Notifier *n, Surface *s) {
+  if (s->argb_pic) return s->argb_pic;
+  Display *dpy = n->dpy;
+  s->argb_pm = XCreatePixmap(dpy, RootWindow(dpy, n->screen), (unsigned)s->w, (unsigned)s->h, 32);
+  s->argb_pic = XRenderCreatePicture(dpy, s->argb_pm, n->argb_fmt, 0, NULL);
+  XRenderColor clear = { 0, 0, 0, 0 };
+  XRenderFillRectangle(dpy, PictOpSrc, s->argb_pic, &clear, 0, 0, (unsigned)s->w, (unsigned)s->h);
 
-  /* Named semaphore to serialize notifications across processes. The
-   * name can be overridden with X11NOTIF_SEMNAME; default is
-   * "/x11notif_sem". If we cannot open the semaphore we continue
-   * without serialization. */
-  const char *semname = getenv("X11NOTIF_SEMNAME");
-  if (!semname) semname = "/x11notif_sem";
-  sem_t *notif_sem = sem_open(semname, O_CREAT, 0644, 1);
-  if (notif_sem == SEM_FAILED) {
-    perror("sem_open");
-    notif_sem = NULL;
-  } else {
-    /* Acquire (decrement) the semaphore; this will block until the
-     * previous notifier posts. On EINTR retry. On other errors give
-     * up serialization and continue. */
-    while (sem_wait(notif_sem) == -1) {
-      if (errno == EINTR) continue;
-      perror("sem_wait");
-      notif_sem = NULL;
-      break;
+  Picture src = XRenderCreatePicture(dpy, s->pm, XRenderFindVisualFormat(dpy, DefaultVisual(dpy, n->screen)), 0, NULL);
+  Region r = make_parallelogram_region(s->w, s->h, n->slant);
+  XRenderSetPictureClipRegion(dpy, s->argb_pic, r);
+  XRenderComposite(dpy, PictOpSrc, src, None, s->argb_pic, 0,0, 0,0, 0,0, (unsigned)s->w, (unsigned)s->h);
+  XDestroyRegion(r);
+  XRenderFreePicture(dpy, src);
+
+  XRenderPictureAttributes pa;
+  pa.clip_mask = None;
+  XRenderChangePicture(dpy, s->argb_pic, CPClipMask, &pa);
+  return s->argb_pic;
+}
+
+static int notifier_row_y(const Notifier *n, int k) {
+  return n->mons[k % n->nmon].y_org + n->margin_y + (k / n->nmon) * (n->h + STACK_GAP);
+}
+
+/* Put window k's notification at root x. Normally that moves the shaped
+ * window; in ARGB mode the window stays put and the surface is
+ * composited at the new offset, clearing only the band it uncovered. */
+static void notifier_place(Notifier *n, int k, int x) {
+  Display *dpy = n->dpy;
+  int m = k % n->nmon;
+  if (!n->argb) {
+    XMoveWindow(dpy, n->wins[k], x, notifier_row_y(n, k));
+    return;
+  }
+  int w = n->mons[m].width, h = n->h;
+  int off = x - n->mons[m].x_org, prev = n->offsets[k];
+  XRenderColor clear = { 0, 0, 0, 0 };
+  if (off > prev) { // moved right: [prev, off) is uncovered
+    int x0 = prev < 0 ? 0 : prev, x1 = off < w ? off : w;
+    if (x1 > x0) XRenderFillRectangle(dpy, PictOpSrc, n->win_pics[k], &clear, x0, 0, (unsigned)(x1 - x0), (unsigned)h);
+  } else if (off < prev) { // moved left: [off + w, prev + w)
+    int x0 = off + w < 0 ? 0 : off + w, x1 = prev + w < w ? prev + w : w;
+    if (x1 > x0) XRenderFillRectangle(dpy, PictOpSrc, n->win_pics[k], &clear, x0, 0, (unsigned)(x1 - x0), (unsigned)h);
+  }
+  int x0 = off < 0 ? 0 : off, x1 = off + w < w ? off + w : w;
+  if (x1 > x0)
+    XRenderComposite(dpy, PictOpSrc, n->cur_pics[k], None, n->win_pics[k],
+                     x0 - off, 0, 0, 0, x0, 0, (unsigned)(x1 - x0), (unsigned)h);
+  n->offsets[k] = off;
+}
+
+static int compositor_running(Display *dpy, int screen) {
+  char name[32];
+  snprintf(name, sizeof name, "_NET_WM_CM_S%d", screen);
+  return XGetSelectionOwner(dpy, XInternAtom(dpy, name, False)) != None;
+}
+
+static int allow_argb = 1; // --no-argb
+static int click_dismiss;  // --dismiss: a click on a notification closes it
+
+/* Frame period of each monitor from the refresh rate of the CRTC at its
+ * origin (the fastest one if several are cloned there); 60 Hz for
+ * monitors RandR does not describe. */
+static void query_refresh(Notifier *n) {
+  Display *dpy = n->dpy;
+  for (int m = 0; m < n->nmon; ++m) n->period_ns[m] = 0;
+  int ev, err, major = 0, minor = 0;
+  if (XRRQueryExtension(dpy, &ev, &err) && XRRQueryVersion(dpy, &major, &minor) &&
+      (major > 1 || (major == 1 && minor >= 3))) {
+    XRRScreenResources *res = XRRGetScreenResourcesCurrent(dpy, RootWindow(dpy, n->screen));
+    for (int c = 0; res && c < res->ncrtc; ++c) {
+      XRRCrtcInfo *ci = XRRGetCrtcInfo(dpy, res, res->crtcs[c]);
+      if (!ci) continue;
+      for (int k = 0; ci->mode && k < res->nmode; ++k) {
+        const XRRModeInfo *mi = &res->modes[k];
+        if (mi->id != ci->mode || !mi->hTotal || !mi->vTotal) continue;
+        double hz = (double)mi->dotClock / ((double)mi->hTotal * (double)mi->vTotal);
+        if (mi->modeFlags & RR_DoubleScan) hz /= 2;
+        if (mi->modeFlags & RR_Interlace) hz *= 2;
+        if (hz < 1) break;
+        int64_t period = (int64_t)(1e9 / hz);
+        for (int m = 0; m < n->nmon; ++m) {
+          if (n->mons[m].x_org != ci->x || n->mons[m].y_org != ci->y) continue;
+          if (!n->period_ns[m] || period < n->period_ns[m]) n->period_ns[m] = period;
+        }
+        break;
+      }
+      XRRFreeCrtcInfo(ci);
     }
+    if (res) XRRFreeScreenResources(res);
+  }
+  for (int m = 0; m < n->nmon; ++m)
+    if (!n->period_ns[m]) n->period_ns[m] = 1000000000LL / 60;
+}
+
+static int font_bold = 1; // --no-bold
+
+/* Open the embedded Verdana straight from memory. The pattern is complete
+ * (face, pixel size, Xft's display defaults), so neither the system
+ * fontconfig configuration nor its cache is ever loaded; that matching was
+ * most of a cold start. Bold is synthesized with FC_EMBOLDEN. */
+static XftFont *xft_font_from_memory(Display *dpy, int screen,
+                                     const unsigned char *data, size_t len,
+                                     double pixel_size, int bold,
+                                     FT_Library *out_lib, FT_Face *out_face) {
+  FT_Library lib = NULL;
+  if (FT_Init_FreeType(&lib)) return NULL;
+  FT_Face face = NULL;
+  if (FT_New_Memory_Face(lib, data, (FT_Long)len, 0, &face)) {
+    FT_Done_FreeType(lib);
+    return NULL;
+  }
+  FcPattern *pat = FcFreeTypeQueryFace(face, (const FcChar8 *)"memory", 0, NULL);
+  if (!pat) {
+    FT_Done_Face(face);
+    FT_Done_FreeType(lib);
+    return NULL;
+  }
+  FcPatternDel(pat, FC_FILE);
+  FcPatternDel(pat, FC_INDEX);
+  FcPatternAddFTFace(pat, FC_FT_FACE, face);
+  FcPatternAddBool(pat, FC_SCALABLE, FcTrue);
+  FcPatternAddDouble(pat, FC_PIXEL_SIZE, pixel_size);
+  if (bold) FcPatternAddBool(pat, FC_EMBOLDEN, FcTrue);
+  XftDefaultSubstitute(dpy, screen, pat);
+  XftFont *xf = XftFontOpenPattern(dpy, pat); // owns pat on success
+  if (!xf) {
+    FcPatternDestroy(pat);
+    FT_Done_Face(face);
+    FT_Done_FreeType(lib);
+    return NULL;
   }
+  *out_lib = lib;
+  *out_face = face;
+  return xf;
+}
 
-  Display *dpy = XOpenDisplay(NULL);
+static int notifier_open(Notifier *n, const char *fontname, int nslot) {
+  memset(n, 0, sizeof *n);
+  Display *dpy = n->dpy = XOpenDisplay(NULL);
   if (!dpy) {
     fprintf(stderr, "Cannot open display.");
-    return 1;
+    return -1;
   }
+  timing_mark("display");
 
-  int screen = DefaultScreen(dpy);
+  int screen = n->screen = DefaultScreen(dpy);
   int sw = DisplayWidth(dpy, screen);
   int sh = DisplayHeight(dpy, screen);
 
   // Multi-monitor support via Xinerama
-  int nmon = 0;
-  XineramaScreenInfo *mons = NULL;
-  int mons_from_xinerama = 0;
   {
     int xev, xerr;
     if (XineramaQueryExtension(dpy, &xev, &xerr) && XineramaIsActive(dpy)) {
-      mons = XineramaQueryScreens(dpy, &nmon);
-      mons_from_xinerama = (mons != NULL);
+      n->mons = XineramaQueryScreens(dpy, &n->nmon);
+      n->mons_from_xinerama = (n->mons != NULL);
     }
   }
-  if (nmon <= 0) {
+  if (n->nmon <= 0) {
     // fallback: single monitor covering the default screen
-    nmon = 1;
-    mons = (XineramaScreenInfo *)calloc(1, sizeof(XineramaScreenInfo));
-    mons[0].x_org = 0;
-    mons[0].y_org = 0;
-    mons[0].width = sw;
-    mons[0].height = sh;
+    n->nmon = 1;
+    n->mons = (XineramaScreenInfo *)calloc(1, sizeof(XineramaScreenInfo));
+    n->mons[0].x_org = 0;
+    n->mons[0].y_org = 0;
+    n->mons[0].width = sw;
+    n->mons[0].height = sh;
   }
 
-  int margin_y = 32;  // distance from top of screen
-  int w = sw;       // full screen width
-  int h = 48;       // notification height
-  int slant = 32;     // pixels of skew on top edge
+  n->margin_y = 32; // distance from top of screen
+  n->h = 48;        // notification height
+  n->slant = 32;    // pixels of skew on top edge
+  if (n->h > sh) n->h = sh / 4;
+  if (n->slant > sw/2) n->slant = sw/2;
 
-  if (h > sh) h = sh / 4;
-  if (slant < 0) slant = 0; if (slant > w/2) slant = w/2;
+  Colormap cmap = DefaultColormap(dpy, screen);
+  Visual *vis = DefaultVisual(dpy, screen);
+  XColor col_scr, col_accent;
+  XAllocNamedColor(dpy, cmap, "#131634", &col_accent, &col_scr);
+  n->accent = col_accent.pixel;
+  XRenderColor xr_fg = { 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF }; // white
+  XRenderColor xr_shadow = { 0x0000, 0x0000, 0x0000, 0x7FFF }; // semi black
+  XftColorAllocValue(dpy, vis, cmap, &xr_shadow, &n->shadow);
+  XftColorAllocValue(dpy, vis, cmap, &xr_fg, &n->fg);
+
+  // X11NOTIF_FONT opts into fontconfig matching; the default skips it
+  if (fontname) n->font = XftFontOpenName(dpy, screen, fontname);
+  if (!n->font)
+    n->font = xft_font_from_memory(dpy, screen, verdana_ttf, (size_t)verdana_ttf_len, 20.0, font_bold, &n->ft_lib, &n->ft_face);
+  if (!n->font) n->font = XftFontOpenName(dpy, screen, "Sans:pixelsize=20");
+  timing_mark("font");
 
   XSetWindowAttributes attrs;
   attrs.override_redirect = True;
   attrs.backing_store = WhenMapped;
   attrs.save_under = True;
-  attrs.event_mask = ExposureMask;
+  attrs.event_mask = ExposureMask | (click_dismiss ? ButtonPressMask : 0);
+  unsigned long attr_mask = CWOverrideRedirect | CWBackingStore | CWSaveUnder | CWEventMask;
+  int depth = CopyFromParent;
+  Visual *win_vis = CopyFromParent;
 
-  Window *wins = (Window*)calloc((size_t)nmon, sizeof(Window));
+  XVisualInfo vi;
+  if (allow_argb && compositor_running(dpy, screen) && XMatchVisualInfo(dpy, screen, 32, TrueColor, &vi)) {
+    XRenderPictFormat *fmt = XRenderFindVisualFormat(dpy, vi.visual);
+    if (fmt && fmt->type == PictTypeDirect && fmt->direct.alphaMask) {
+      n->argb = 1;
+      n->argb_vis = vi.visual;
+      n->argb_fmt = fmt;
+      n->argb_cmap = XCreateColormap(dpy, RootWindow(dpy, screen), vi.visual, AllocNone);
+      // the compositor keeps the contents; the server only needs to clear
+      attrs.background_pixel = 0;
+      attrs.border_pixel = 0;
+      attrs.colormap = n->argb_cmap;
+      attr_mask = CWOverrideRedirect | CWBackPixel | CWBorderPixel | CWColormap | CWEventMask;
+      depth = 32;
+      win_vis = vi.visual;
+    }
+  }
 
-  for (int i = 0; i < nmon; ++i) {
-    int mw = mons[i].width;
-    int mh = mons[i].height;
-    int mx = mons[i].x_org;
-    int my = mons[i].y_org;
+  n->nslot = nslot;
+  size_t nwin = (size_t)(nslot * n->nmon);
+  n->wins = (Window*)calloc(nwin, sizeof(Window));
+  n->period_ns = (int64_t*)calloc((size_t)n->nmon, sizeof(int64_t));
+  n->next_ns = (int64_t*)calloc(nwin, sizeof(int64_t));
+  if (n->argb) {
+    n->win_pics = (Picture*)calloc(nwin, sizeof(Picture));
+    n->cur_pics = (Picture*)calloc(nwin, sizeof(Picture));
+    n->offsets = (int*)calloc(nwin, sizeof(int));
+  }
+  n->live_pms = (Pixmap*)calloc(nwin, sizeof(Pixmap));
+  n->live_pics = (Picture*)calloc(nwin, sizeof(Picture));
+  // enough that every window can hold one surface and the rest still caches
+  n->nsurf = (int)nwin + 8;
+  n->surfaces = (Surface*)calloc((size_t)n->nsurf, sizeof(Surface));
+  query_refresh(n);
+  n->gc = XCreateGC(dpy, RootWindow(dpy, screen), 0, NULL);
+  n->draw = XftDrawCreate(dpy, RootWindow(dpy, screen), vis, cmap);
 
-    int ww = mw; // full monitor width
-    if (h > mh) h = mh / 4; // ensure height fits monitor
-    if (slant < 0) slant = 0; if (slant > ww/2) slant = ww/2;
+  int shape_event_base, shape_error_base;
+  int have_shape = XShapeQueryExtension(dpy, &shape_event_base, &shape_error_base);
+  for (int i = 0; i < n->nmon; ++i) {
+    if (n->h > n->mons[i].height) n->h = n->mons[i].height / 4; // ensure height fits monitor
+    if (n->slant > n->mons[i].width/2) n->slant = n->mons[i].width/2;
+  }
+  for (int k = 0; k < (int)nwin; ++k) {
+    int ww = n->mons[k % n->nmon].width; // full monitor width
 
-    wins[i] = XCreateWindow(
+    // parked off-screen to the left, where the slide-in starts; ARGB
+    // windows sit at their final position and never move
+    n->wins[k] = XCreateWindow(
       dpy, RootWindow(dpy, screen),
-      mx - ww, my + margin_y,
-      (unsigned int)ww, (unsigned int)h, 0,
-      CopyFromParent, InputOutput, CopyFromParent,
-      CWOverrideRedirect | CWBackingStore | CWSaveUnder | CWEventMask,
-      &attrs);
-
-    int shape_event_base, shape_error_base;
-    if (XShapeQueryExtension(dpy, &shape_event_base, &shape_error_base)) {
-      Region r = make_parallelogram_region(ww, h, slant);
-      XShapeCombineRegion(dpy, wins[i], ShapeBounding, 0, 0, r, ShapeSet);
-      Region empty = XCreateRegion();
-      XShapeCombineRegion(dpy, wins[i], ShapeInput, 0, 0, empty, ShapeSet);
-      XDestroyRegion(empty);
+      n->mons[k % n->nmon].x_org - (n->argb ? 0 : ww), notifier_row_y(n, k),
+      (unsigned int)ww, (unsigned int)n->h, 0,
+      depth, InputOutput, win_vis, attr_mask, &attrs);
+    if (n->argb) n->win_pics[k] = XRenderCreatePicture(dpy, n->wins[k], n->argb_fmt, 0, NULL);
+
+    if (have_shape) {
+      Region r = make_parallelogram_region(ww, n->h, n->slant);
+      if (!n->argb) XShapeCombineRegion(dpy, n->wins[k], ShapeBounding, 0, 0, r, ShapeSet);
+      // clicks land on the parallelogram only, or pass through entirely
+      Region input = click_dismiss ? r : XCreateRegion();
+      XShapeCombineRegion(dpy, n->wins[k], ShapeInput, 0, 0, input, ShapeSet);
+      if (input != r) XDestroyRegion(input);
       XDestroyRegion(r);
     }
+  }
+  timing_mark("windows");
+  return 0;
+}
 
-    XMapRaised(dpy, wins[i]);
-    draw_notification(dpy, wins[i], ww, h, slant, msg, fontname);
+static void notifier_close(Notifier *n) {
+  Display *dpy = n->dpy;
+  Visual *vis = DefaultVisual(dpy, n->screen);
+  Colormap cmap = DefaultColormap(dpy, n->screen);
+  for (int k = 0; k < n->nslot * n->nmon; ++k) {
+    if (n->live_pics[k]) XRenderFreePicture(dpy, n->live_pics[k]);
+    if (n->live_pms[k]) XFreePixmap(dpy, n->live_pms[k]);
+    if (n->argb) XRenderFreePicture(dpy, n->win_pics[k]);
+    XDestroyWindow(dpy, n->wins[k]);
   }
-  XFlush(dpy);
+  for (int i = 0; i < n->nsurf; ++i) surface_free(n, &n->surfaces[i]);
+  free(n->surfaces);
+  if (n->argb) XFreeColormap(dpy, n->argb_cmap);
+  XftDrawDestroy(n->draw);
+  XFreeGC(dpy, n->gc);
+  if (n->font) XftFontClose(dpy, n->font);
+  if (n->ft_face) FT_Done_Face(n->ft_face);
+  if (n->ft_lib) FT_Done_FreeType(n->ft_lib);
+  XftColorFree(dpy, vis, cmap, &n->fg);
+  XftColorFree(dpy, vis, cmap, &n->shadow);
+  if (n->mons) {
+    if (n->mons_from_xinerama) XFree(n->mons);
+    else free(n->mons);
+  }
+  free(n->wins);
+  free(n->win_pics);
+  free(n->cur_pics);
+  free(n->offsets);
+  free(n->live_pms);
+  free(n->live_pics);
+  free(n->period_ns);
+  free(n->next_ns);
+  XCloseDisplay(dpy);
+}
+
+/* OSD bar, right-aligned inside the parallelogram */
+static XRectangle osd_bar_rect(const Notifier *n, int w) {
+  XRectangle r;
+  r.width = (unsigned short)(w / 4 < 160 ? w / 4 : 160);
+  r.height = 6;
+  r.x = (short)(w - 48 - n->slant / 2 - r.width);
+  r.y = (short)((n->h - r.height) / 2);
+  return r;
+}
 
-  const int fps = 30;
-  const long frame_ns = 1000000000L / fps;
-  const int slide_in_ms = 300;
-  const int hold_ms = 2000;
-  const int slide_out_ms = 300;
+/* Redraw the bar in window k's live copy of `base`, restoring the
+ * rectangle from the surface first, and push just that rectangle to
+ * the window. */
+static void notifier_bar(Notifier *n, int k, Surface *base, int value) {
+  Display *dpy = n->dpy;
+  XRectangle r = osd_bar_rect(n, base->w);
+  if (n->argb)
+    XRenderComposite(dpy, PictOpSrc, surface_argb(n, base), None, n->live_pics[k],
+                     r.x, r.y, 0, 0, r.x, r.y, r.width, r.height);
+  else
+    XCopyArea(dpy, base->pm, n->live_pms[k], n->gc, r.x, r.y, r.width, r.height, r.x, r.y);
 
-  int frames_in = slide_in_ms * fps / 1000;
-  int frames_out = slide_out_ms * fps / 1000;
+  XRenderColor track = rgba(0xFF, 0xFF, 0xFF, 0x40), fill = rgba(0xFF, 0xFF, 0xFF, 0xFF);
+  XRenderFillRectangle(dpy, PictOpOver, n->live_pics[k], &track, r.x, r.y, r.width, r.height);
+  unsigned fw = (unsigned)(r.width * value / 100);
+  if (fw) XRenderFillRectangle(dpy, PictOpSrc, n->live_pics[k], &fill, r.x, r.y, fw, r.height);
 
-  // Per-monitor animation targets
-  int *mon_x = (int*)calloc((size_t)nmon, sizeof(int));
-  int *mon_w = (int*)calloc((size_t)nmon, sizeof(int));
-  int *mon_y = (int*)calloc((size_t)nmon, sizeof(int));
-  for (int i = 0; i < nmon; ++i) {
-    mon_x[i] = mons[i].x_org;
-    mon_w[i] = mons[i].width;
-    mon_y[i] = mons[i].y_org + margin_y;
+  if (!n->argb) {
+    XClearArea(dpy, n->wins[k], r.x, r.y, r.width, r.height, False);
+  } else if (n->offsets[k] > -base->w) {
+    XRenderComposite(dpy, PictOpSrc, n->live_pics[k], None, n->win_pics[k],
+                     r.x, r.y, 0, 0, n->offsets[k] + r.x, r.y, r.width, r.height);
   }
+}
 
-  // Slide in from left with ease-out cubic
-  for (int i = 0; i <= frames_in; ++i) {
-    double t = (double)i / (double)frames_in; // 0..1
-    double te = 1.0 - (1.0 - t)*(1.0 - t)*(1.0 - t);
-    for (int m = 0; m < nmon; ++m) {
-      int ww = mon_w[m];
-      int start_x = mon_x[m] - ww;
-      int x = (int)(start_x + te * (ww)); // moves from left off-screen to monitor.x_org
-      XMoveWindow(dpy, wins[m], x, mon_y[m]);
+/* Show `msg` in row `slot`: on first use before notifier_map, or to
+ * replace what a visible row says. With a value (0..100) the window
+ * shows a live copy of the surface with the bar drawn in, so later
+ * value changes only touch the bar. */
+static void notifier_attach(Notifier *n, int slot, const char *msg, int value) {
+  Display *dpy = n->dpy;
+  for (int m = 0; m < n->nmon; ++m) {
+    int k = slot * n->nmon + m;
+    int w = n->mons[m].width;
+    Surface *surf = notifier_surface(n, w, msg);
+    if (value >= 0) {
+      if (!n->live_pms[k]) {
+        n->live_pms[k] = XCreatePixmap(dpy, RootWindow(dpy, n->screen), (unsigned)w, (unsigned)n->h,
+                                       n->argb ? 32 : (unsigned)DefaultDepth(dpy, n->screen));
+        n->live_pics[k] = XRenderCreatePicture(dpy, n->live_pms[k], n->argb ? n->argb_fmt :
+                                               XRenderFindVisualFormat(dpy, DefaultVisual(dpy, n->screen)), 0, NULL);
+      }
+      if (n->argb)
+        XRenderComposite(dpy, PictOpSrc, surface_argb(n, surf), None, n->live_pics[k], 0,0, 0,0, 0,0, (unsigned)w, (unsigned)n->h);
+      else
+        XCopyArea(dpy, surf->pm, n->live_pms[k], n->gc, 0, 0, (unsigned)w, (unsigned)n->h, 0, 0);
+      notifier_bar(n, k, surf, value);
+    }
+    if (n->argb) {
+      n->cur_pics[k] = value >= 0 ? n->live_pics[k] : surface_argb(n, surf);
+      notifier_place(n, k, n->mons[m].x_org + n->offsets[k]); // redraw where it is
+    } else {
+      XSetWindowBackgroundPixmap(dpy, n->wins[k], value >= 0 ? n->live_pms[k] : surf->pm);
+      XClearWindow(dpy, n->wins[k]);
     }
-    XFlush(dpy);
-    nsleep(frame_ns);
   }
+}
+
+/* value-only update of an OSD row */
+static void notifier_set_value(Notifier *n, int slot, const char *msg, int value) {
+  for (int m = 0; m < n->nmon; ++m)
+    notifier_bar(n, slot * n->nmon + m, notifier_surface(n, n->mons[m].width, msg), value);
+}
+
+/* map a row's windows just off-screen to the left */
+static void notifier_map(Notifier *n, int slot) {
+  for (int m = 0; m < n->nmon; ++m) {
+    int k = slot * n->nmon + m;
+    if (n->argb) n->offsets[k] = -n->mons[m].width; // mapping clears the window
+    else XMoveWindow(n->dpy, n->wins[k], n->mons[m].x_org - n->mons[m].width, notifier_row_y(n, k));
+    XMapRaised(n->dpy, n->wins[k]);
+  }
+}
+
+static void notifier_unmap(Notifier *n, int slot) {
+  for (int m = 0; m < n->nmon; ++m) {
+    int k = slot * n->nmon + m;
+    XUnmapWindow(n->dpy, n->wins[k]);
+    if (n->argb) n->cur_pics[k] = None;
+  }
+}
+
+/* index of one of our windows, -1 for anything else */
+static int notifier_window(const Notifier *n, Window win) {
+  for (int k = 0; k < n->nslot * n->nmon; ++k)
+    if (n->wins[k] == win) return k;
+  return -1;
+}
+
+/* Repair an exposed rectangle of window k. Plain windows have their
+ * surface as background pixmap, so the server has already repainted it;
+ * ARGB windows are only cleared and get the covered part composited
+ * again from the surface they are showing. */
+static void notifier_expose(Notifier *n, int k, int x, int y, int w, int h) {
+  if (!n->argb || !n->cur_pics[k]) return;
+  int off = n->offsets[k], sw = n->mons[k % n->nmon].width;
+  int x0 = x > off ? x : off, x1 = x + w < off + sw ? x + w : off + sw;
+  if (x1 > x0)
+    XRenderComposite(n->dpy, PictOpSrc, n->cur_pics[k], None, n->win_pics[k],
+                     x0 - off, y, 0, 0, x0, y, (unsigned)(x1 - x0), (unsigned)h);
+}
+
+static int runtime_path(char *out, size_t n, const char *ext) {
+  const char *dir = getenv("XDG_RUNTIME_DIR");
+  int len;
+  if (dir && *dir) len = snprintf(out, n, "%s/x11notif.%s", dir, ext);
+  else len = snprintf(out, n, "/tmp/x11notif-%u.%s", (unsigned)getuid(), ext);
+  return (len > 0 && (size_t)len < n) ? 0 : -1;
+}
+
+static int socket_path(char *out, size_t n) { return runtime_path(out, n, "sock"); }
+
+static int socket_connect(void) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  if (socket_path(addr.sun_path, sizeof addr.sun_path) < 0) return -1;
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof addr) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/* longest prefix of s[0..len) within max bytes that ends on a character */
+static size_t utf8_clip(const char *s, size_t len, size_t max) {
+  if (len <= max) return len;
+  len = max;
+  while (len > 0 && ((unsigned char)s[len] & 0xC0) == 0x80) --len;
+  return len;
+}
+
+/* Thin client: one packet to the daemon, version 2 for an OSD update.
+ * Returns -1 if there is no daemon. */
+static int send_to_daemon(const char *msg, int urgency, uint32_t osd, int value) {
+  int fd = socket_connect();
+  if (fd < 0) return -1;
+  size_t len = utf8_clip(msg, strlen(msg), NOTIF_TEXT_MAX);
+  unsigned char buf[sizeof(NotifWireOsd) + NOTIF_TEXT_MAX];
+  NotifWireOsd pkt = { { NOTIF_WIRE_MAGIC, NOTIF_WIRE_VERSION, (uint8_t)urgency, (uint32_t)len }, osd, value };
+  size_t hlen = sizeof pkt.h;
+  if (osd || value >= 0) {
+    pkt.h.version = NOTIF_WIRE_VERSION_OSD;
+    hlen = sizeof pkt;
+  }
+  memcpy(buf, &pkt, hlen);
+  memcpy(buf + hlen, msg, len);
+  ssize_t sent = send(fd, buf, hlen + len, MSG_NOSIGNAL);
+  close(fd);
+  return sent == (ssize_t)(hlen + len) ? 0 : -1;
+}
+
+/* Standalone notifications take an exclusive flock on a runtime file so
+ * they don't slide over each other. The kernel drops the lock when its
+ * holder exits, however it dies, and a waiter gives up after
+ * LOCK_TIMEOUT_S and shows its notification anyway. */
+#define LOCK_TIMEOUT_S 10
+
+static void on_lock_alarm(int sig) { (void)sig; }
+
+/* the locked fd, or -1 to go ahead unserialized */
+static int serialize_lock(void) {
+  char path[108];
+  const char *env = getenv("X11NOTIF_LOCK");
+  if (env && *env) snprintf(path, sizeof path, "%s", env);
+  else if (runtime_path(path, sizeof path, "lock") < 0) return -1;
+  int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    perror(path);
+    return -1;
+  }
+  if (flock(fd, LOCK_EX | LOCK_NB) == 0) return fd;
+
+  struct sigaction sa, old;
+  memset(&sa, 0, sizeof sa);
+  sa.sa_handler = on_lock_alarm; // no SA_RESTART: flock() returns EINTR
+  sigaction(SIGALRM, &sa, &old);
+  alarm(LOCK_TIMEOUT_S);
+  int rc = flock(fd, LOCK_EX);
+  int err = errno;
+  alarm(0);
+  sigaction(SIGALRM, &old, NULL);
+  if (rc == 0) return fd;
+  fprintf(stderr, "x11notif: %s: %s, not waiting any longer\n", path,
+          err == EINTR ? "still locked" : strerror(err));
+  close(fd);
+  return -1;
+}
+
+/* Scheduler. Up to stack_size notifications are on screen at once, one
+ * per row; the rest wait in two bounded lanes, critical first. Identical
+ * text arriving within DEDUP_MS is folded into the existing entry with a
+ * counter. Nothing here blocks or talks to a client: submissions only
+ * change this state, and stack_tick() moves the windows from whichever
+ * loop is driving it. */
+#define QUEUE_MAX 32
+#define DEDUP_MS 10000
+#define SLIDE_IN_MS 300
+#define SLIDE_OUT_MS 300
+
+enum { CLOSE_EXPIRED = 1, CLOSE_DISMISSED = 2, CLOSE_CALLED = 3, CLOSE_UNDEFINED = 4 };
+
+typedef struct {
+  uint32_t id;  // D-Bus notification id, 0 for socket submissions
+  uint32_t osd; // socket replace id, 0 for none
+  int urgency;
+  int hold_ms;
+  int value;    // OSD bar 0..100, -1 for none
+  int count;       // identical submissions folded into this one
+  int64_t arrived; // when the latest of them came in
+  char text[NOTIF_TEXT_MAX + 1];
+} QueuedNotif;
+
+typedef struct {
+  QueuedNotif items[QUEUE_MAX];
+  int head, count;
+} Lane;
+
+enum { SLOT_IDLE, SLOT_IN, SLOT_HOLD, SLOT_OUT };
+
+typedef struct {
+  int state;
+  int64_t t0;       // start of the current slide
+  int64_t hold_end; // 0: until closed or the row is needed
+  int dirty;        // text changed: redraw
+  int bar_dirty;    // only the OSD value changed
+  int64_t bar_at;   // last bar redraw, for coalescing to one per frame
+  int rehold;       // restart the hold
+  int leave;        // closed: slide out as soon as it is in
+  int reason;       // for NotificationClosed
+  QueuedNotif q;
+} Slot;
+
+static Lane lanes[2]; // indexed by urgency
+static Slot slots[STACK_MAX];
+static int stack_size = 3;   // --stack=N
+static int stack_changed;    // something to schedule; ends the daemon's wait
+
+static void notify_closed(uint32_t id, uint32_t reason);
+
+static QueuedNotif *lane_at(Lane *l, int i) { return &l->items[(l->head + i) % QUEUE_MAX]; }
+
+static QueuedNotif *lane_push(Lane *l) {
+  if (l->count == QUEUE_MAX) { // drop the oldest rather than block clients
+    notify_closed(l->items[l->head].id, CLOSE_UNDEFINED);
+    l->head = (l->head + 1) % QUEUE_MAX;
+    --l->count;
+  }
+  return lane_at(l, l->count++);
+}
+
+static int lane_pop(Lane *l, QueuedNotif *out) {
+  if (l->count == 0) return 0;
+  *out = l->items[l->head];
+  l->head = (l->head + 1) % QUEUE_MAX;
+  --l->count;
+  return 1;
+}
+
+static void lane_remove(QueuedNotif *q) {
+  for (int u = 0; u < 2; ++u) {
+    Lane *l = &lanes[u];
+    for (int i = 0; i < l->count; ++i) {
+      if (lane_at(l, i) != q) continue;
+      for (; i + 1 < l->count; ++i) *lane_at(l, i) = *lane_at(l, i + 1);
+      --l->count;
+      return;
+    }
+  }
+}
+
+/* a notification by id, on screen (*slot set) or waiting; a row already
+ * sliding out counts as gone, like in notif_find_osd */
+static QueuedNotif *notif_find(uint32_t id, Slot **slot) {
+  *slot = NULL;
+  for (int i = 0; i < stack_size; ++i) {
+    if ((slots[i].state == SLOT_IN || slots[i].state == SLOT_HOLD) && !slots[i].leave && slots[i].q.id == id) {
+      *slot = &slots[i];
+      return &slots[i].q;
+    }
+  }
+  for (int u = 0; u < 2; ++u)
+    for (int i = 0; i < lanes[u].count; ++i)
+      if (lane_at(&lanes[u], i)->id == id) return lane_at(&lanes[u], i);
+  return NULL;
+}
+
+/* The id of a row on its way out now names its replacement: don't report
+ * the old row closed when it is gone. */
+static void notif_disown(uint32_t id) {
+  for (int i = 0; i < stack_size; ++i)
+    if (slots[i].state != SLOT_IDLE && slots[i].q.id == id) slots[i].q.id = 0;
+}
+
+/* an OSD notification by replace id; a row already sliding out counts
+ * as gone */
+static QueuedNotif *notif_find_osd(uint32_t osd, Slot **slot) {
+  *slot = NULL;
+  for (int i = 0; i < stack_size; ++i) {
+    if ((slots[i].state == SLOT_IN || slots[i].state == SLOT_HOLD) && !slots[i].leave && slots[i].q.osd == osd) {
+      *slot = &slots[i];
+      return &slots[i].q;
+    }
+  }
+  for (int u = 0; u < 2; ++u)
+    for (int i = 0; i < lanes[u].count; ++i)
+      if (lane_at(&lanes[u], i)->osd == osd) return lane_at(&lanes[u], i);
+  return NULL;
+}
+
+static QueuedNotif *notif_queue(int urgency, const char *text, size_t len, int hold_ms) {
+  QueuedNotif *q = lane_push(&lanes[urgency ? 1 : 0]);
+  memset(q, 0, sizeof *q);
+  q->urgency = urgency ? 1 : 0;
+  q->hold_ms = hold_ms;
+  q->value = -1;
+  q->count = 1;
+  q->arrived = mono_ns();
+  memcpy(q->text, text, len);
+  q->text[len] = '\0';
+  stack_changed = 1;
+  return q;
+}
+
+/* Replace a notification's text and value; a visible one is redrawn
+ * (just the bar if only the value changed) and held again. */
+static void notif_update(QueuedNotif *q, Slot *slot, const char *text, size_t len, int value) {
+  if (strlen(q->text) != len || memcmp(q->text, text, len) != 0) {
+    memcpy(q->text, text, len);
+    q->text[len] = '\0';
+    q->count = 1;
+    if (slot) slot->dirty = 1;
+  }
+  if (q->value != value) {
+    q->value = value;
+    if (slot) slot->bar_dirty = 1;
+  }
+  if (slot) slot->rehold = 1;
+  stack_changed = 1;
+}
+
+static void osd_submit(uint32_t osd, int urgency, const char *text, size_t len, int value) {
+  Slot *slot;
+  QueuedNotif *q = osd ? notif_find_osd(osd, &slot) : NULL;
+  if (value > 100) value = 100;
+  if (q) {
+    notif_update(q, slot, text, len, value);
+    return;
+  }
+  q = notif_queue(urgency, text, len, DEFAULT_HOLD_MS);
+  q->osd = osd;
+  q->value = value;
+}
 
-  // Hold
-  int hold_frames = hold_ms * fps / 1000;
-  for (int i = 0; i < hold_frames; ++i) {
-#ifdef DO_REPAINT
-    if (i % fps == 0) {
-      for (int m = 0; m < nmon; ++m) {
-        draw_notification(dpy, wins[m], mon_w[m], h, slant, msg, fontname);
+/* Queue a message or fold it into an identical one that is visible or
+ * waiting. Never blocks; a full lane loses its oldest entry. */
+static QueuedNotif *notif_submit(int urgency, const char *text, size_t len, int hold_ms) {
+  int64_t now = mono_ns(), window = (int64_t)DEDUP_MS * 1000000LL;
+  urgency = urgency ? 1 : 0;
+  stack_changed = 1;
+
+  for (int i = 0; i < stack_size; ++i) {
+    Slot *s = &slots[i];
+    if ((s->state != SLOT_IN && s->state != SLOT_HOLD) || s->leave || s->q.osd || s->q.value >= 0) continue;
+    if (strlen(s->q.text) != len || memcmp(s->q.text, text, len) != 0 || now - s->q.arrived > window) continue;
+    ++s->q.count;
+    s->q.arrived = now;
+    s->dirty = s->rehold = 1;
+    return &s->q;
+  }
+  for (int u = 0; u < 2; ++u) {
+    for (int i = 0; i < lanes[u].count; ++i) {
+      QueuedNotif *q = lane_at(&lanes[u], i);
+      if (q->osd || q->value >= 0) continue;
+      if (strlen(q->text) != len || memcmp(q->text, text, len) != 0 || now - q->arrived > window) continue;
+      ++q->count;
+      q->arrived = now;
+      if (urgency <= u) return q;
+      QueuedNotif up = *q; // promoted to the critical lane
+      lane_remove(q);
+      up.urgency = urgency;
+      q = lane_push(&lanes[urgency]);
+      *q = up;
+      return q;
+    }
+  }
+
+  return notif_queue(urgency, text, len, hold_ms);
+}
+
+static const char *slot_text(const Slot *s, char *buf, size_t n) {
+  if (s->q.count <= 1) return s->q.text;
+  snprintf(buf, n, "%s \xc3\x97%d", s->q.text, s->q.count); // "×3"
+  return buf;
+}
+
+static void slot_start(Notifier *n, int i, const QueuedNotif *q, int64_t now) {
+  Slot *s = &slots[i];
+  char buf[NOTIF_TEXT_MAX + 16];
+  memset(s, 0, sizeof *s);
+  s->q = *q;
+  s->state = SLOT_IN;
+  s->t0 = now;
+  s->reason = CLOSE_EXPIRED;
+  notifier_map(n, i);
+  notifier_attach(n, i, slot_text(s, buf, sizeof buf), s->q.value);
+  s->bar_at = now;
+  for (int m = 0; m < n->nmon; ++m) n->next_ns[i * n->nmon + m] = now;
+}
+
+static void slot_leave(Notifier *n, int i, int64_t now) {
+  slots[i].state = SLOT_OUT;
+  slots[i].t0 = now;
+  for (int m = 0; m < n->nmon; ++m) n->next_ns[i * n->nmon + m] = now;
+}
+
+/* Advance row i's slide (ease-out cubic in, ease-in cubic out) to `now`.
+ * Each monitor gets frames on its own refresh period against absolute
+ * deadlines; positions come from the elapsed time, so a late frame skips
+ * ahead instead of stretching the animation. Returns 1 once finished. */
+static int slot_slide(Notifier *n, int i, int64_t now, int64_t *wake) {
+  const int64_t done = INT64_MAX;
+  Slot *s = &slots[i];
+  int out = (s->state == SLOT_OUT), pending = 0;
+  int64_t dur = (int64_t)(out ? SLIDE_OUT_MS : SLIDE_IN_MS) * 1000000LL;
+  for (int m = 0; m < n->nmon; ++m) {
+    int k = i * n->nmon + m;
+    if (n->next_ns[k] == done) continue;
+    if (now >= n->next_ns[k]) {
+      int64_t missed = (now - n->next_ns[k]) / n->period_ns[m];
+      frame_stats_record(now - n->next_ns[k], missed);
+
+      double t = (now - s->t0 >= dur) ? 1.0 : (double)(now - s->t0) / (double)dur; // 0..1
+      double te = out ? t*t*t : 1.0 - (1.0 - t)*(1.0 - t)*(1.0 - t);
+      int ww = n->mons[m].width;
+      // in: from left off-screen to monitor.x_org; out: fully off-screen to the right
+      notifier_place(n, k, (int)(n->mons[m].x_org + (out ? te * ww : (te - 1.0) * ww)));
+      if (!out && te > 0.0) timing_first_pixel(n->dpy);
+
+      if (t >= 1.0) {
+        n->next_ns[k] = done;
+        continue;
       }
+      n->next_ns[k] += (missed + 1) * n->period_ns[m];
+    }
+    ++pending;
+    if (n->next_ns[k] < *wake) *wake = n->next_ns[k];
+  }
+  return !pending;
+}
+
+/* Run the scheduler at `now` and return when it next needs to run
+ * (INT64_MAX: not until something is submitted). */
+static int64_t stack_tick(Notifier *n, int64_t now) {
+  int64_t wake = INT64_MAX;
+  stack_changed = 0;
+
+  // With every row busy, a waiting critical message cuts the oldest
+  // normal hold short, and anything waiting ends a hold-until-closed.
+  if (lanes[0].count || lanes[1].count) {
+    int busy = 1, victim = -1;
+    for (int i = 0; i < stack_size; ++i) {
+      const Slot *s = &slots[i];
+      if (s->state == SLOT_IDLE || s->state == SLOT_OUT) busy = 0;
+      if (s->state != SLOT_HOLD || !(s->hold_end == 0 || (lanes[1].count && !s->q.urgency))) continue;
+      if (victim < 0 || s->t0 < slots[victim].t0) victim = i;
     }
-    XFlush(dpy);
-#else
-    nsleep(frame_ns);
-#endif
+    if (busy && victim >= 0) slot_leave(n, victim, now);
+  }
+  for (int i = 0; i < stack_size; ++i) {
+    QueuedNotif q;
+    if (slots[i].state != SLOT_IDLE) continue;
+    if (!lane_pop(&lanes[1], &q) && !lane_pop(&lanes[0], &q)) break;
+    slot_start(n, i, &q, now);
   }
 
-  // Slide out to the right with ease-in cubic
-  for (int i = 0; i <= frames_out; ++i) {
-    double t = (double)i / (double)frames_out; // 0..1
-    double te = t*t*t;
-    for (int m = 0; m < nmon; ++m) {
-      int start = mon_x[m];
-      int x = (int)(start + te * (mon_w[m])); // move fully off-screen to the right of this monitor
-      XMoveWindow(dpy, wins[m], x, mon_y[m]);
+  for (int i = 0; i < stack_size; ++i) {
+    Slot *s = &slots[i];
+    if (s->state == SLOT_IDLE) continue;
+    if (s->state != SLOT_OUT) {
+      char buf[NOTIF_TEXT_MAX + 16];
+      if (s->dirty) {
+        notifier_attach(n, i, slot_text(s, buf, sizeof buf), s->q.value);
+        s->dirty = s->bar_dirty = 0;
+        s->bar_at = now;
+      } else if (s->bar_dirty) {
+        // a held key sends updates faster than the screen refreshes:
+        // draw the latest value at most once per frame
+        int64_t due = s->bar_at + n->period_ns[0];
+        for (int m = 1; m < n->nmon; ++m)
+          if (s->bar_at + n->period_ns[m] < due) due = s->bar_at + n->period_ns[m];
+        if (now >= due) {
+          notifier_set_value(n, i, slot_text(s, buf, sizeof buf), s->q.value);
+          s->bar_dirty = 0;
+          s->bar_at = now;
+        } else if (due < wake) {
+          wake = due;
+        }
+      }
+      if (s->rehold && s->state == SLOT_HOLD && s->hold_end)
+        s->hold_end = now + (int64_t)s->q.hold_ms * 1000000LL;
+      s->rehold = 0;
+    }
+    if (s->state == SLOT_IN && slot_slide(n, i, now, &wake)) {
+      s->state = SLOT_HOLD;
+      s->hold_end = s->q.hold_ms > 0 ? now + (int64_t)s->q.hold_ms * 1000000LL : 0;
+    }
+    if (s->state == SLOT_HOLD) {
+      if (s->leave || (s->hold_end && now >= s->hold_end)) slot_leave(n, i, now);
+      else if (s->hold_end && s->hold_end < wake) wake = s->hold_end;
+    }
+    if (s->state == SLOT_OUT && slot_slide(n, i, now, &wake)) {
+      notifier_unmap(n, i);
+      s->state = SLOT_IDLE;
+      notify_closed(s->q.id, (uint32_t)s->reason);
+      if (print_stats) frame_stats_dump(stderr);
+      if (lanes[0].count || lanes[1].count) wake = now; // a row is free
     }
-    XFlush(dpy);
-    nsleep(frame_ns);
   }
-  for (int m = 0; m < nmon; ++m) {
-    XUnmapWindow(dpy, wins[m]);
-    XDestroyWindow(dpy, wins[m]);
+  XFlush(n->dpy);
+  return wake;
+}
+
+/* Handle an event on our windows: Expose damage, and with --dismiss a
+ * click, which closes that row like CloseNotification would. */
+static void stack_event(Notifier *n, XEvent *ev) {
+  int k;
+  switch (ev->type) {
+  case Expose:
+    k = notifier_window(n, ev->xexpose.window);
+    if (k >= 0) notifier_expose(n, k, ev->xexpose.x, ev->xexpose.y, ev->xexpose.width, ev->xexpose.height);
+    break;
+  case ButtonPress:
+    k = notifier_window(n, ev->xbutton.window);
+    if (k < 0) break;
+    Slot *s = &slots[k / n->nmon];
+    if ((s->state == SLOT_IN || s->state == SLOT_HOLD) && !s->leave) {
+      s->leave = 1;
+      s->reason = CLOSE_DISMISSED;
+      stack_changed = 1;
+    }
+    break;
   }
+}
 
-  if (mons) {
-    if (mons_from_xinerama) XFree(mons);
-    else free(mons);
+static void stack_events(Notifier *n) {
+  while (XPending(n->dpy)) {
+    XEvent ev;
+    XNextEvent(n->dpy, &ev);
+    stack_event(n, &ev);
   }
-  free(wins);
-  free(mon_x);
-  free(mon_w);
-  free(mon_y);
+}
 
-  if (notif_sem) {
-    if (sem_post(notif_sem) == -1) perror("sem_post");
-    if (sem_close(notif_sem) == -1) perror("sem_close");
+/* Standalone counterpart of daemon_wait_until: block on the X connection
+ * until `deadline`, servicing events, instead of sleeping through them. */
+static void stack_wait_until(Notifier *n, int64_t deadline) {
+  struct pollfd pfd = { ConnectionNumber(n->dpy), POLLIN, 0 };
+  for (;;) {
+    stack_events(n);
+    if (stack_changed) return;
+    int64_t left_ms = (deadline - mono_ns()) / 1000000LL;
+    if (left_ms <= 0) break;
+    poll(&pfd, 1, left_ms > INT32_MAX ? -1 : (int)left_ms);
   }
+  sleep_until_ns(deadline);
+}
 
-  XCloseDisplay(dpy);
+/* Daemon state: a listening socket and its clients (x11power keeps one
+ * connection open). */
+#define CLIENTS_MAX 16
+
+static int listen_fd = -1;
+static int client_fds[CLIENTS_MAX];
+static int client_count;
+static Notifier *daemon_n;
+static volatile sig_atomic_t daemon_quit;
+static volatile sig_atomic_t dump_stats;
+
+static void on_quit_signal(int sig) { (void)sig; daemon_quit = 1; }
+static void on_stats_signal(int sig) { (void)sig; dump_stats = 1; }
+
+/* drain every packet a client has sent; 0 once it has gone away */
+static int client_read(int fd) {
+  unsigned char buf[sizeof(NotifWireOsd) + NOTIF_TEXT_MAX];
+  for (;;) {
+    // MSG_TRUNC: the packet's real length, so oversize ones can't pass as short
+    ssize_t got = recv(fd, buf, sizeof buf, MSG_DONTWAIT | MSG_TRUNC);
+    if (got == 0) return 0;
+    if (got < 0) return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 1 : 0;
+    NotifWireOsd pkt;
+    size_t hlen = sizeof pkt.h;
+    if ((size_t)got > sizeof buf) {
+      fprintf(stderr, "x11notif: dropping oversize packet\n");
+      continue;
+    }
+    if ((size_t)got < hlen) continue;
+    memcpy(&pkt.h, buf, hlen);
+    int version_ok = pkt.h.version == NOTIF_WIRE_VERSION;
+    if (pkt.h.version == NOTIF_WIRE_VERSION_OSD && (size_t)got >= sizeof pkt) {
+      memcpy(&pkt, buf, sizeof pkt);
+      hlen = sizeof pkt;
+      version_ok = 1;
+    }
+    if (pkt.h.magic != NOTIF_WIRE_MAGIC || !version_ok ||
+        pkt.h.len > NOTIF_TEXT_MAX || pkt.h.len != (size_t)got - hlen) {
+      fprintf(stderr, "x11notif: dropping malformed packet\n");
+      continue;
+    }
+    const char *text = (const char *)buf + hlen;
+    if (hlen == sizeof pkt) osd_submit(pkt.replace_id, pkt.h.urgency, text, pkt.h.len, pkt.value < 0 ? -1 : pkt.value);
+    else notif_submit(pkt.h.urgency, text, pkt.h.len, DEFAULT_HOLD_MS);
+  }
+}
+
+/* --ring: the shared-memory ring of x11notif_ring.h. Producers share the
+ * mapping, so every slot is copied out before it is looked at and dropped
+ * unless it validates. */
+_Static_assert(NOTIF_RING_TEXT_MAX == NOTIF_TEXT_MAX, "ring slots carry one message");
+
+static NotifRing *ring;
+static int ring_fd = -1; // wake socket
+
+/* Build the ring under a temporary name and rename it into place, after
+ * the wake socket is bound, so clients only ever map a usable one. */
+static int ring_open(void) {
+  char path[64], tmp[80];
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  if (notif_ring_path(path, sizeof path, "ring") < 0 ||
+      notif_ring_path(addr.sun_path, sizeof addr.sun_path, "wake") < 0) return -1;
+  snprintf(tmp, sizeof tmp, "%s.%d", path, (int)getpid());
+  int fd = open(tmp, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  if (fd < 0) { perror(tmp); return -1; }
+  void *p = MAP_FAILED;
+  if (ftruncate(fd, sizeof(NotifRing)) == 0)
+    p = mmap(NULL, sizeof(NotifRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    perror(tmp);
+    unlink(tmp);
+    return -1;
+  }
+  ring = p;
+  ring->version = NOTIF_RING_VERSION;
+  ring->nslots = NOTIF_RING_SLOTS;
+  ring->slot_size = sizeof(NotifRingSlot);
+  for (uint32_t i = 0; i < NOTIF_RING_SLOTS; ++i) atomic_init(&ring->slots[i].seq, i);
+  ring->magic = NOTIF_RING_MAGIC;
+
+  unlink(addr.sun_path); // left by a daemon that died; daemon_listen ruled out a live one
+  ring_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  mode_t old = umask(0077);
+  int rc = ring_fd < 0 ? -1 : bind(ring_fd, (struct sockaddr *)&addr, sizeof addr);
+  umask(old);
+  if (rc < 0 || rename(tmp, path) < 0) {
+    perror(rc < 0 ? addr.sun_path : path);
+    if (ring_fd >= 0) close(ring_fd);
+    if (rc == 0) unlink(addr.sun_path);
+    ring_fd = -1;
+    unlink(tmp);
+    munmap(ring, sizeof(NotifRing));
+    ring = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+static void ring_unlink(void) {
+  char path[108];
+  if (!ring) return;
+  if (notif_ring_path(path, sizeof path, "ring") == 0) unlink(path);
+  if (notif_ring_path(path, sizeof path, "wake") == 0) unlink(path);
+  close(ring_fd);
+  munmap(ring, sizeof(NotifRing));
+  ring = NULL;
+}
+
+/* is the slot at head published (or garbage)? */
+static int ring_ready(void) {
+  uint32_t h = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  return atomic_load_explicit(&ring->slots[h & (NOTIF_RING_SLOTS - 1)].seq, memory_order_acquire) != h;
+}
+
+/* A producer that dies between reserving a slot and publishing it would
+ * leave the head slot unpublished for good, and everyone behind it with a
+ * full ring. Every RING_STALL_MS that the head slot stays reserved, check
+ * whether the pid recorded in it still exists, and reclaim the slot only
+ * once it doesn't. A live producer, however slow, may still be storing
+ * into the slot, so it is never handed to anyone else. (A producer killed
+ * in the few instructions before it records its pid still wedges the
+ * ring.) */
+#define RING_STALL_MS 300
+
+static int64_t ring_stall_at; // when the head slot was last seen reserved by a live producer, 0: not stalled
+
+static int ring_owner_gone(const NotifRingSlot *s) {
+  pid_t pid = atomic_load_explicit(&s->pid, memory_order_relaxed);
+  return pid > 0 && kill(pid, 0) < 0 && errno == ESRCH;
+}
+
+/* Consume every published slot in order. A slot reserved but not yet
+ * published ends the pass; its producer wakes us once it is. */
+static void ring_drain(void) {
+  char b[16];
+  while (recv(ring_fd, b, sizeof b, 0) > 0) {}
+  uint32_t h = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  for (;; ++h) {
+    NotifRingSlot *s = &ring->slots[h & (NOTIF_RING_SLOTS - 1)];
+    uint32_t seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail == h) { // nothing reserved: only a stray store can make seq differ
+      if (seq != h) atomic_store_explicit(&s->seq, h, memory_order_release);
+      ring_stall_at = 0;
+      break;
+    }
+    if (seq == h) {
+      int64_t now = mono_ns();
+      if (!ring_stall_at) ring_stall_at = now;
+      if (now - ring_stall_at < (int64_t)RING_STALL_MS * 1000000LL) break;
+      if (!ring_owner_gone(s)) { // alive: look again later
+        ring_stall_at = now;
+        break;
+      }
+      // nobody can publish it any more
+      atomic_store_explicit(&s->pid, 0, memory_order_relaxed);
+      atomic_store_explicit(&s->seq, h + NOTIF_RING_SLOTS, memory_order_release);
+      atomic_store_explicit(&ring->head, h + 1, memory_order_relaxed);
+      ring_stall_at = 0;
+      fprintf(stderr, "x11notif: reclaiming ring slot of dead producer\n");
+      continue;
+    }
+    ring_stall_at = 0;
+    int urgency = s->urgency, value = s->value;
+    uint32_t replace_id = s->replace_id;
+    size_t len = s->len;
+    char text[NOTIF_TEXT_MAX];
+    int ok = seq == h + 1 && urgency <= 1 && value >= -1 && value <= 100 && len <= NOTIF_TEXT_MAX;
+    if (ok) memcpy(text, s->text, len);
+    // hand the slot back to the producer one lap ahead
+    atomic_store_explicit(&s->pid, 0, memory_order_relaxed);
+    atomic_store_explicit(&s->seq, h + NOTIF_RING_SLOTS, memory_order_release);
+    atomic_store_explicit(&ring->head, h + 1, memory_order_relaxed);
+    if (!ok) {
+      fprintf(stderr, "x11notif: dropping malformed ring slot\n");
+      continue;
+    }
+    len = utf8_clip(text, len, NOTIF_TEXT_MAX);
+    // plain messages fold into identical ones, like socket v1 packets
+    if (replace_id || value >= 0) osd_submit(replace_id, urgency, text, len, value);
+    else notif_submit(urgency, text, len, DEFAULT_HOLD_MS);
+  }
+}
+
+/* poll() timeout that wakes us in time to recheck a stalled head slot */
+static int ring_timeout(int timeout_ms) {
+  if (!ring_stall_at) return timeout_ms;
+  int64_t left_ms = (ring_stall_at + (int64_t)RING_STALL_MS * 1000000LL - mono_ns()) / 1000000LL + 1;
+  if (left_ms < 0) left_ms = 0;
+  return (timeout_ms < 0 || left_ms < timeout_ms) ? (int)left_ms : timeout_ms;
+}
+
+/* org.freedesktop.Notifications server (Desktop Notifications spec 1.2).
+ * Only the method handlers run inside libdbus; they queue work and reply
+ * immediately, and the connection is read and written from daemon_pump. */
+#define NOTIFY_NAME "org.freedesktop.Notifications"
+#define NOTIFY_PATH "/org/freedesktop/Notifications"
+#define NOTIFY_IFACE "org.freedesktop.Notifications"
+
+static DBusConnection *bus;
+static int bus_fd = -1;
+static uint32_t next_id = 1;
+
+static void bus_drain(void) {
+  dbus_connection_read_write(bus, 0);
+  while (dbus_connection_dispatch(bus) == DBUS_DISPATCH_DATA_REMAINS)
+    ;
+}
+
+static void notify_closed(uint32_t id, uint32_t reason) {
+  if (!bus || !id) return;
+  DBusMessage *sig = dbus_message_new_signal(NOTIFY_PATH, NOTIFY_IFACE, "NotificationClosed");
+  if (!sig) return;
+  dbus_message_append_args(sig, DBUS_TYPE_UINT32, &id, DBUS_TYPE_UINT32, &reason, DBUS_TYPE_INVALID);
+  dbus_connection_send(bus, sig, NULL);
+  dbus_message_unref(sig);
+}
+
+/* "summary — body" on one line; we don't advertise body-markup */
+static size_t notify_text(char *out, const char *summary, const char *body) {
+  size_t n = 0;
+  const char *parts[3] = { summary, (*summary && *body) ? " \xe2\x80\x94 " : "", body };
+  for (int p = 0; p < 3; ++p) {
+    size_t len = utf8_clip(parts[p], strlen(parts[p]), NOTIF_TEXT_MAX - n);
+    for (size_t i = 0; i < len; ++i) {
+      char c = parts[p][i];
+      out[n++] = ((unsigned char)c < 0x20) ? ' ' : c;
+    }
+  }
+  out[n] = '\0';
+  return n;
+}
+
+static DBusMessage *notify_method(DBusMessage *m) {
+  const char *app, *icon, *summary, *body;
+  uint32_t replaces;
+  int32_t expire;
+  DBusMessageIter it, sub;
+  if (!dbus_message_iter_init(m, &it) || strcmp(dbus_message_get_signature(m), "susssasa{sv}i") != 0)
+    return dbus_message_new_error(m, DBUS_ERROR_INVALID_ARGS, "expected (susssasa{sv}i)");
+  dbus_message_iter_get_basic(&it, &app); dbus_message_iter_next(&it);
+  dbus_message_iter_get_basic(&it, &replaces); dbus_message_iter_next(&it);
+  dbus_message_iter_get_basic(&it, &icon); dbus_message_iter_next(&it);
+  dbus_message_iter_get_basic(&it, &summary); dbus_message_iter_next(&it);
+  dbus_message_iter_get_basic(&it, &body); dbus_message_iter_next(&it);
+  dbus_message_iter_next(&it); // actions: not supported
+
+  int urgency = 0, value = -1;
+  dbus_message_iter_recurse(&it, &sub);
+  for (; dbus_message_iter_get_arg_type(&sub) == DBUS_TYPE_DICT_ENTRY; dbus_message_iter_next(&sub)) {
+    DBusMessageIter e, v;
+    const char *key;
+    dbus_message_iter_recurse(&sub, &e);
+    dbus_message_iter_get_basic(&e, &key);
+    dbus_message_iter_next(&e);
+    dbus_message_iter_recurse(&e, &v);
+    if (strcmp(key, "urgency") == 0 && dbus_message_iter_get_arg_type(&v) == DBUS_TYPE_BYTE) {
+      unsigned char u;
+      dbus_message_iter_get_basic(&v, &u);
+      urgency = (u >= 2);
+    } else if (strcmp(key, "value") == 0 && dbus_message_iter_get_arg_type(&v) == DBUS_TYPE_INT32) {
+      int32_t val;
+      dbus_message_iter_get_basic(&v, &val);
+      value = val < 0 ? -1 : val > 100 ? 100 : val;
+    }
+  }
+  dbus_message_iter_next(&it);
+  dbus_message_iter_get_basic(&it, &expire);
+
+  char text[NOTIF_TEXT_MAX + 1];
+  size_t len = notify_text(text, summary, body);
+  int hold_ms = expire < 0 ? DEFAULT_HOLD_MS : expire; // 0: until closed
+  Slot *slot;
+  QueuedNotif *q = replaces ? notif_find(replaces, &slot) : NULL;
+  if (q) { // update in place; on screen it is redrawn and held again
+    if (!slot && q->urgency != urgency) { // waiting: move to the other lane
+      QueuedNotif moved = *q;
+      lane_remove(q);
+      moved.urgency = urgency;
+      q = lane_push(&lanes[urgency]);
+      *q = moved;
+    }
+    q->urgency = urgency;
+    q->hold_ms = hold_ms;
+    notif_update(q, slot, text, len, value);
+  } else if (replaces || value >= 0) { // a replacement keeps its own id: no folding
+    if (replaces) notif_disown(replaces);
+    q = notif_queue(urgency, text, len, hold_ms);
+    q->value = value;
+  } else {
+    q = notif_submit(urgency, text, len, hold_ms);
+  }
+  if (!q->id) {
+    q->id = replaces ? replaces : next_id++;
+    if (!next_id) next_id = 1;
+  }
+
+  DBusMessage *r = dbus_message_new_method_return(m);
+  if (r) dbus_message_append_args(r, DBUS_TYPE_UINT32, &q->id, DBUS_TYPE_INVALID);
+  return r;
+}
+
+static DBusMessage *close_method(DBusMessage *m) {
+  uint32_t id;
+  if (!dbus_message_get_args(m, NULL, DBUS_TYPE_UINT32, &id, DBUS_TYPE_INVALID))
+    return dbus_message_new_error(m, DBUS_ERROR_INVALID_ARGS, "expected (u)");
+  Slot *slot;
+  QueuedNotif *q = id ? notif_find(id, &slot) : NULL;
+  if (q && slot) { // signalled once it has slid out
+    slot->leave = 1;
+    slot->reason = CLOSE_CALLED;
+    stack_changed = 1;
+  } else if (q) {
+    lane_remove(q);
+    notify_closed(id, CLOSE_CALLED);
+  }
+  return dbus_message_new_method_return(m);
+}
+
+static DBusHandlerResult notify_handler(DBusConnection *c, DBusMessage *m, void *user) {
+  (void)user;
+  if (dbus_message_get_type(m) != DBUS_MESSAGE_TYPE_METHOD_CALL)
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+  const char *iface = dbus_message_get_interface(m);
+  if (iface && strcmp(iface, NOTIFY_IFACE) != 0)
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+  DBusMessage *r;
+  if (dbus_message_has_member(m, "Notify")) {
+    r = notify_method(m);
+  } else if (dbus_message_has_member(m, "CloseNotification")) {
+    r = close_method(m);
+  } else if (dbus_message_has_member(m, "GetCapabilities")) {
+    static const char *caps[] = { "body" };
+    const char **p = caps;
+    r = dbus_message_new_method_return(m);
+    if (r) dbus_message_append_args(r, DBUS_TYPE_ARRAY, DBUS_TYPE_STRING, &p, 1, DBUS_TYPE_INVALID);
+  } else if (dbus_message_has_member(m, "GetServerInformation")) {
+    const char *name = "x11notif", *vendor = "x11notif", *version = "1.0.0", *spec = "1.2";
+    r = dbus_message_new_method_return(m);
+    if (r) dbus_message_append_args(r, DBUS_TYPE_STRING, &name, DBUS_TYPE_STRING, &vendor,
+                                    DBUS_TYPE_STRING, &version, DBUS_TYPE_STRING, &spec, DBUS_TYPE_INVALID);
+  } else {
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+  }
+  if (!r) return DBUS_HANDLER_RESULT_NEED_MEMORY;
+  dbus_connection_send(c, r, NULL);
+  dbus_message_unref(r);
+  return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+static int bus_open(void) {
+  DBusError err;
+  dbus_error_init(&err);
+  bus = dbus_bus_get(DBUS_BUS_SESSION, &err);
+  if (!bus) {
+    fprintf(stderr, "x11notif: session bus: %s\n", err.message);
+    dbus_error_free(&err);
+    return -1;
+  }
+  dbus_connection_set_exit_on_disconnect(bus, FALSE);
+  int rc = dbus_bus_request_name(bus, NOTIFY_NAME, DBUS_NAME_FLAG_DO_NOT_QUEUE, &err);
+  if (rc != DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER) {
+    fprintf(stderr, "x11notif: cannot own %s: %s\n", NOTIFY_NAME,
+            dbus_error_is_set(&err) ? err.message : "another notification server is running");
+    dbus_error_free(&err);
+    dbus_connection_unref(bus);
+    bus = NULL;
+    return -1;
+  }
+  static const DBusObjectPathVTable vtable = { .message_function = notify_handler };
+  dbus_connection_register_object_path(bus, NOTIFY_PATH, &vtable, NULL);
+  dbus_connection_get_unix_fd(bus, &bus_fd);
+  return 0;
+}
+
+/* wait up to timeout_ms for clients, the X connection, the bus or a signal */
+static void daemon_pump(int timeout_ms) {
+  struct pollfd pfds[4 + CLIENTS_MAX];
+  pfds[0].fd = listen_fd; pfds[0].events = POLLIN;
+  pfds[1].fd = ConnectionNumber(daemon_n->dpy); pfds[1].events = POLLIN;
+  pfds[2].fd = bus_fd; pfds[2].events = POLLIN; // -1 without --dbus: ignored
+  if (bus && dbus_connection_has_messages_to_send(bus)) pfds[2].events |= POLLOUT;
+  pfds[3].fd = ring_fd; pfds[3].events = POLLIN; // -1 without --ring
+  for (int i = 0; i < client_count; ++i) {
+    pfds[4 + i].fd = client_fds[i];
+    pfds[4 + i].events = POLLIN;
+  }
+  if (XPending(daemon_n->dpy)) timeout_ms = 0;
+  if (bus && dbus_connection_get_dispatch_status(bus) == DBUS_DISPATCH_DATA_REMAINS) timeout_ms = 0;
+  if (ring) {
+    // park, then look once more: a producer that published before seeing
+    // parked is caught here, any later one sends a wake-up
+    atomic_store_explicit(&ring->parked, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    timeout_ms = ring_ready() ? 0 : ring_timeout(timeout_ms);
+  }
+  int rc = poll(pfds, (nfds_t)(4 + client_count), timeout_ms);
+  if (ring) {
+    atomic_store_explicit(&ring->parked, 0, memory_order_relaxed);
+    ring_drain();
+  }
+  if (rc < 0) return; // EINTR: let the caller look at daemon_quit
+
+  if (bus) bus_drain();
+
+  stack_events(daemon_n);
+
+  for (int i = client_count - 1; i >= 0; --i) {
+    if (!pfds[4 + i].revents) continue;
+    if (!client_read(client_fds[i])) {
+      close(client_fds[i]);
+      client_fds[i] = client_fds[--client_count];
+    }
+  }
+  if (pfds[0].revents & POLLIN) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd >= 0) {
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+      if (client_count == CLIENTS_MAX) close(fd);
+      else {
+        client_fds[client_count++] = fd;
+        if (!client_read(fd)) { close(fd); --client_count; }
+      }
+    }
+  }
+}
+
+/* Serve clients until `deadline` or until there is something new to
+ * schedule. poll() only has millisecond resolution: pump whole
+ * milliseconds, then sleep out the remainder against the deadline. */
+static void daemon_wait_until(int64_t deadline) {
+  for (;;) {
+    if (stack_changed || daemon_quit || dump_stats) return;
+    if (deadline == INT64_MAX) {
+      daemon_pump(-1);
+      continue;
+    }
+    int64_t left_ms = (deadline - mono_ns()) / 1000000LL;
+    if (left_ms <= 0) break;
+    daemon_pump((int)left_ms);
+  }
+  sleep_until_ns(deadline);
+}
+
+static int daemon_listen(void) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  if (socket_path(addr.sun_path, sizeof addr.sun_path) < 0) return -1;
+  int probe = socket_connect();
+  if (probe >= 0) {
+    close(probe);
+    fprintf(stderr, "x11notif: a daemon is already listening on %s\n", addr.sun_path);
+    return -1;
+  }
+  unlink(addr.sun_path); // stale socket from a daemon that died
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd < 0) { perror("socket"); return -1; }
+  mode_t old = umask(0077);
+  int rc = bind(fd, (struct sockaddr *)&addr, sizeof addr);
+  umask(old);
+  if (rc < 0 || listen(fd, 16) < 0) {
+    perror(addr.sun_path);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static void daemon_unlink(void) {
+  char path[108];
+  if (socket_path(path, sizeof path) == 0) unlink(path);
+  close(listen_fd);
+}
+
+static int run_daemon(const char *fontname, int use_dbus, int use_ring) {
+  listen_fd = daemon_listen();
+  if (listen_fd < 0) return 1;
+  if ((use_dbus && bus_open() < 0) || (use_ring && ring_open() < 0)) {
+    ring_unlink();
+    daemon_unlink();
+    return 1;
+  }
+
+  Notifier n;
+  if (notifier_open(&n, fontname, stack_size) < 0) {
+    ring_unlink();
+    daemon_unlink();
+    return 1;
+  }
+  daemon_n = &n;
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof sa);
+  sa.sa_handler = on_quit_signal; // no SA_RESTART: poll() has to return
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  sa.sa_handler = on_stats_signal;
+  sigaction(SIGUSR1, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  while (!daemon_quit) {
+    daemon_wait_until(stack_tick(&n, mono_ns()));
+    if (dump_stats) {
+      dump_stats = 0;
+      frame_stats_dump(stderr);
+    }
+  }
+
+  ring_unlink();
+  daemon_unlink();
+  for (int i = 0; i < client_count; ++i) close(client_fds[i]);
+  if (bus) {
+    dbus_connection_flush(bus);
+    dbus_connection_unref(bus);
+  }
+  notifier_close(&n);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  setlocale(LC_ALL, "");
+
+  if (getenv("X11NOTIF_TIMING")) {
+    ntiming = 0;
+    timing_mark("main");
+  }
+  const char *fontname = getenv("X11NOTIF_FONT");
+  int daemon = 0, use_dbus = 0, use_ring = 0, urgency = 0, value = -1;
+  uint32_t osd = 0;
+  const char *msg = "Hello, world!";
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--daemon") == 0) daemon = 1;
+    else if (strcmp(argv[i], "--dbus") == 0) daemon = use_dbus = 1;
+    else if (strcmp(argv[i], "--ring") == 0) daemon = use_ring = 1;
+    else if (strcmp(argv[i], "--critical") == 0) urgency = 1;
+    else if (strcmp(argv[i], "--stats") == 0) print_stats = 1;
+    else if (strncmp(argv[i], "--osd=", 6) == 0) osd = (uint32_t)strtoul(argv[i] + 6, NULL, 10);
+    else if (strncmp(argv[i], "--value=", 8) == 0) {
+      value = atoi(argv[i] + 8);
+      if (value < 0) value = 0;
+      if (value > 100) value = 100;
+    }
+    else if (strcmp(argv[i], "--no-argb") == 0) allow_argb = 0;
+    else if (strcmp(argv[i], "--dismiss") == 0) click_dismiss = 1;
+    else if (strcmp(argv[i], "--no-bold") == 0) font_bold = 0;
+    else if (strncmp(argv[i], "--stack=", 8) == 0) {
+      stack_size = atoi(argv[i] + 8);
+      if (stack_size < 1) stack_size = 1;
+      if (stack_size > STACK_MAX) stack_size = STACK_MAX;
+    }
+    else msg = argv[i];
+  }
+  if (daemon) return run_daemon(fontname, use_dbus, use_ring);
+
+  // A running daemon takes the message in one packet; otherwise show it
+  // from this process as before.
+  if (send_to_daemon(msg, urgency, osd, value) == 0) return 0;
+  timing_mark("daemon probe");
+
+  /* Serialize with other standalone notifiers. The path can be
+   * overridden with X11NOTIF_LOCK. Failing or timing out just means
+   * showing unserialized. */
+  int lock_fd = serialize_lock();
+  timing_mark("lock");
+
+  Notifier n;
+  stack_size = 1;
+  if (notifier_open(&n, fontname, stack_size) < 0) return 1;
+  osd_submit(osd, urgency, msg, utf8_clip(msg, strlen(msg), NOTIF_TEXT_MAX), value);
+  for (;;) {
+    int64_t wake = stack_tick(&n, mono_ns());
+    if (wake == INT64_MAX) break;
+    stack_wait_until(&n, wake);
+  }
+  notifier_close(&n);
+  if (lock_fd >= 0) close(lock_fd); // releases the lock
   return 0;
 }
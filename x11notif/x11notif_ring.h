@@ -0,0 +1,176 @@
+/* x11notif_ring.h - header-only client for the x11notif daemon's
+ * shared-memory submission ring (x11notif --ring).
+ *
+ * The daemon maps /dev/shm/x11notif-<uid>.ring: a header and a power-of-two
+ * array of fixed-size slots. Producers in any number of processes and
+ * threads reserve a slot by advancing `tail` with a compare-and-swap, fill
+ * it with plain stores and publish it by storing the slot's sequence
+ * number. The daemon is the only consumer. Submitting costs no system call
+ * unless the daemon is parked in poll(); then the one producer that clears
+ * `parked` sends a byte to the datagram socket /dev/shm/x11notif-<uid>.wake.
+ *
+ *   NotifRingClient c;
+ *   if (notif_ring_open(&c) == 0) {
+ *     if (notif_ring_send(&c, 0, 0, -1, "disk full", 9) < 0 && errno == EAGAIN)
+ *       ; // ring full: back off and retry, or drop
+ *     notif_ring_close(&c);
+ *   }
+ *
+ * A full ring fails with EAGAIN instead of blocking. Text longer than
+ * NOTIF_RING_TEXT_MAX fails with EMSGSIZE. The daemon drops slots that
+ * don't validate. A reserved slot records its producer's pid; if the slot
+ * stays unpublished and that process no longer exists, the daemon takes
+ * it back so the ring doesn't stay full behind it. A producer that is
+ * alive keeps its slot however long it takes (or stays stopped): handing
+ * the slot to someone else while its owner may still be writing to it
+ * would mix two messages. */
+#ifndef X11NOTIF_RING_H
+#define X11NOTIF_RING_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define NOTIF_RING_MAGIC 0x4b52584eu // "NXRK"
+#define NOTIF_RING_VERSION 2
+#define NOTIF_RING_SLOTS 256 // power of two
+#define NOTIF_RING_TEXT_MAX 512
+
+typedef struct {
+  /* ticket t may fill the slot when seq == t; it is published when
+   * seq == t + 1, and the consumer frees it with t + NOTIF_RING_SLOTS */
+  _Atomic uint32_t seq;
+  uint8_t urgency;     // 0 normal, 1 critical
+  uint8_t pad;
+  uint16_t len;        // bytes of UTF-8 text, no NUL
+  uint32_t replace_id; // like --osd=ID; 0 for none
+  int32_t value;       // bar 0..100, -1 for none
+  _Atomic int32_t pid; // producer that reserved it, 0 until recorded
+  char text[NOTIF_RING_TEXT_MAX];
+} __attribute__((aligned(64))) NotifRingSlot;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t nslots;
+  uint32_t slot_size;
+  _Atomic uint32_t tail __attribute__((aligned(64))); // next ticket to reserve
+  _Atomic uint32_t head __attribute__((aligned(64))); // next ticket to consume
+  _Atomic uint32_t parked; // the daemon is (about to be) asleep in poll()
+  NotifRingSlot slots[NOTIF_RING_SLOTS];
+} NotifRing;
+
+typedef struct {
+  NotifRing *ring;
+  int wake_fd;
+} NotifRingClient;
+
+/* "/dev/shm/x11notif-<uid>.<ext>" */
+static inline int notif_ring_path(char *out, size_t n, const char *ext) {
+  int len = snprintf(out, n, "/dev/shm/x11notif-%u.%s", (unsigned)getuid(), ext);
+  return (len > 0 && (size_t)len < n) ? 0 : -1;
+}
+
+/* Map the daemon's ring. -1 if no daemon is serving one. */
+static inline int notif_ring_open(NotifRingClient *c) {
+  char path[64];
+  struct stat st;
+  c->ring = NULL;
+  c->wake_fd = -1;
+  if (notif_ring_path(path, sizeof path, "ring") < 0) return -1;
+  int fd = open(path, O_RDWR | O_CLOEXEC);
+  if (fd < 0) return -1;
+  if (fstat(fd, &st) < 0 || st.st_uid != getuid() || (size_t)st.st_size != sizeof(NotifRing)) {
+    close(fd);
+    errno = EPROTO;
+    return -1;
+  }
+  void *p = mmap(NULL, sizeof(NotifRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) return -1;
+  NotifRing *r = (NotifRing *)p; // renamed into place fully initialized
+  if (r->magic != NOTIF_RING_MAGIC || r->version != NOTIF_RING_VERSION ||
+      r->nslots != NOTIF_RING_SLOTS || r->slot_size != sizeof(NotifRingSlot)) {
+    munmap(p, sizeof(NotifRing));
+    errno = EPROTO;
+    return -1;
+  }
+  // connecting fails if the ring was left behind by a daemon that died
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  if (notif_ring_path(addr.sun_path, sizeof addr.sun_path, "wake") == 0)
+    c->wake_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (c->wake_fd < 0 || connect(c->wake_fd, (struct sockaddr *)&addr, sizeof addr) < 0) {
+    if (c->wake_fd >= 0) close(c->wake_fd);
+    c->wake_fd = -1;
+    munmap(p, sizeof(NotifRing));
+    return -1;
+  }
+  c->ring = r;
+  return 0;
+}
+
+static inline void notif_ring_close(NotifRingClient *c) {
+  if (c->ring) munmap(c->ring, sizeof(NotifRing));
+  if (c->wake_fd >= 0) close(c->wake_fd);
+  c->ring = NULL;
+  c->wake_fd = -1;
+}
+
+/* Queue one notification. 0 on success; -1 with EAGAIN when the ring is
+ * full, EMSGSIZE when the text doesn't fit a slot. */
+static inline int notif_ring_send(NotifRingClient *c, int urgency, uint32_t replace_id, int value,
+                                  const char *text, size_t len) {
+  NotifRing *r = c->ring;
+  if (len > NOTIF_RING_TEXT_MAX) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+  uint32_t t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  NotifRingSlot *s;
+  for (;;) {
+    s = &r->slots[t & (NOTIF_RING_SLOTS - 1)];
+    uint32_t seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+    int32_t diff = (int32_t)(seq - t);
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&r->tail, &t, t + 1, memory_order_relaxed, memory_order_relaxed)) {
+        atomic_store_explicit(&s->pid, (int32_t)getpid(), memory_order_relaxed);
+        break;
+      }
+    } else if (diff < 0) { // still holds the message from one lap ago
+      errno = EAGAIN;
+      return -1;
+    } else { // another producer took t
+      t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    }
+  }
+  s->urgency = urgency ? 1 : 0;
+  s->len = (uint16_t)len;
+  s->replace_id = replace_id;
+  s->value = value;
+  memcpy(s->text, text, len);
+  atomic_store_explicit(&s->seq, t + 1, memory_order_release);
+
+  // pairs with the fence in the daemon between setting parked and its
+  // last look at the ring: either it sees this slot or we see it parked
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&r->parked, memory_order_relaxed) &&
+      atomic_exchange_explicit(&r->parked, 0, memory_order_relaxed)) {
+    char b = 1;
+    // EAGAIN: a wake-up is pending anyway
+    (void)send(c->wake_fd, &b, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+  }
+  return 0;
+}
+
+#endif
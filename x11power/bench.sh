@@ -0,0 +1,133 @@
+#!/bin/sh
+# Main loop benchmark for x11power without real hardware: a private
+# dbus-daemon standing in for the system bus, bench_stubs playing UPower
+# (scripted PropertiesChanged from bench.script) and K16BrightD, Xvfb for
+# the window, and bench-sysfs/ as the sysfs root.
+#
+#   bench.sh [X11POWER [BENCH_STUBS [SRCDIR]]]
+#
+# BENCH_SECONDS (default 30) is how long x11power runs, BENCH_PERIOD_MS
+# (default 10000) how often it reports. Prints x11power's "bench:" lines:
+# wakeups per minute, read/write syscalls per poll cycle, X requests per
+# frame and signal->frame latency percentiles. Without Xvfb x11power runs
+# --headless and a frame is a JSON record. Exits 77 (skipped) without
+# dbus-daemon, 1 if no report came out or a report breaks a bound:
+# BENCH_MAX_WAKEUPS wakeups per minute (default 900, about twice what the
+# script needs) or BENCH_MAX_P99_MS signal->frame p99 (default 50).
+set -eu
+
+x11power=${1:-./x11power}
+stubs=${2:-./bench_stubs}
+srcdir=${3:-$(dirname "$0")}
+seconds=${BENCH_SECONDS:-30}
+period=${BENCH_PERIOD_MS:-10000}
+max_wakeups=${BENCH_MAX_WAKEUPS:-900}
+max_p99=${BENCH_MAX_P99_MS:-50}
+
+if ! command -v dbus-daemon >/dev/null 2>&1; then
+  echo "bench: dbus-daemon not found, skipping"
+  exit 77
+fi
+
+tmp=$(mktemp -d)
+pids=
+cleanup() {
+  for p in $pids; do kill "$p" 2>/dev/null || true; done
+  wait 2>/dev/null || true
+  rm -rf "$tmp"
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+# wait_for SECONDS COMMAND...: poll every 100 ms until COMMAND succeeds
+wait_for() {
+  n=$(($1 * 10))
+  shift
+  while ! "$@" 2>/dev/null; do
+    n=$((n - 1))
+    if [ "$n" -le 0 ]; then return 1; fi
+    sleep 0.1
+  done
+}
+
+cat >"$tmp/bus.conf" <<EOF
+<!DOCTYPE busconfig PUBLIC "-//freedesktop//DTD D-Bus Bus Configuration 1.0//EN"
+ "http://www.freedesktop.org/standards/dbus/1.0/busconfig.dtd">
+<busconfig>
+  <type>session</type>
+  <listen>unix:path=$tmp/bus</listen>
+  <auth>EXTERNAL</auth>
+  <policy context="default">
+    <allow own="*"/>
+    <allow send_destination="*" eavesdrop="true"/>
+    <allow eavesdrop="true"/>
+  </policy>
+</busconfig>
+EOF
+dbus-daemon --config-file="$tmp/bus.conf" --nofork --print-address=3 \
+  3>"$tmp/address" 2>"$tmp/dbus.log" &
+pids="$pids $!"
+if ! wait_for 5 test -s "$tmp/address"; then
+  echo "bench: dbus-daemon did not start" >&2
+  exit 1
+fi
+DBUS_SYSTEM_BUS_ADDRESS=$(head -n 1 "$tmp/address")
+export DBUS_SYSTEM_BUS_ADDRESS
+
+mode=--headless
+if command -v Xvfb >/dev/null 2>&1; then
+  n=$((90 + $$ % 100))
+  Xvfb ":$n" -screen 0 1280x800x24 -nolisten tcp >"$tmp/xvfb.log" 2>&1 &
+  pids="$pids $!"
+  if wait_for 5 test -S "/tmp/.X11-unix/X$n"; then
+    DISPLAY=":$n"
+    export DISPLAY
+    mode=
+  else
+    echo "bench: Xvfb did not start, running headless" >&2
+  fi
+else
+  echo "bench: Xvfb not found, running headless" >&2
+fi
+
+"$stubs" --script="$srcdir/bench.script" >"$tmp/stubs.log" 2>&1 &
+pids="$pids $!"
+if ! wait_for 5 grep -q ready "$tmp/stubs.log"; then
+  echo "bench: bench_stubs did not start" >&2
+  cat "$tmp/stubs.log" >&2
+  exit 1
+fi
+
+# shellcheck disable=SC2086 # $mode is empty or one word
+"$x11power" $mode --bench="$period" --sysfs-root="$srcdir/bench-sysfs" \
+  >/dev/null 2>"$tmp/x11power.log" &
+xp=$!
+pids="$pids $xp"
+sleep "$seconds"
+kill "$xp" 2>/dev/null || true
+wait "$xp" 2>/dev/null || true
+
+if ! grep '^bench:' "$tmp/x11power.log"; then
+  echo "bench: no report from x11power" >&2
+  cat "$tmp/x11power.log" >&2
+  exit 1
+fi
+
+# bench: W wakeups/min, ... signal->frame p50 A p90 B p99 C ms (n=N)
+grep '^bench:' "$tmp/x11power.log" |
+  awk -v max_w="$max_wakeups" -v max_p99="$max_p99" '
+    {
+      for (i = 1; i < NF; ++i) {
+        if ($(i + 1) == "wakeups/min,") w = $i + 0
+        if ($i == "p99") p99 = $(i + 1) + 0
+      }
+      if (w > max_w) {
+        printf "bench: %.1f wakeups/min, bound is %s\n", w, max_w
+        bad = 1
+      }
+      if (p99 > max_p99) {
+        printf "bench: signal->frame p99 %.2f ms, bound is %s\n", p99, max_p99
+        bad = 1
+      }
+    }
+    END { exit bad }' >&2
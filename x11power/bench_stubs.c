@@ -0,0 +1,266 @@
+/* Stand-ins for org.freedesktop.UPower and net.iczelia.K16BrightD, for
+ * the benchmark harness (bench.sh). Connects to whatever bus
+ * DBUS_SYSTEM_BUS_ADDRESS names, owns both services and then replays a
+ * script of display-device changes as PropertiesChanged signals:
+ *
+ *   bench_stubs [--script=FILE] [--count=N]
+ *
+ * Each script line is "DELAY_MS STATE PERCENTAGE ENERGY_RATE"; '#' starts
+ * a comment. The script loops until N signals have been sent (0: until
+ * killed). Every fourth step also changes battery_BAT0, so per-device
+ * row updates get exercised too. "ready" is printed once both names are
+ * owned. */
+#include <dbus/dbus.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define UPOWER_BUS "org.freedesktop.UPower"
+#define UPOWER_PATH "/org/freedesktop/UPower"
+#define UPOWER_IFACE "org.freedesktop.UPower"
+#define UPOWER_DEV_IF "org.freedesktop.UPower.Device"
+#define DISPLAY_PATH "/org/freedesktop/UPower/devices/DisplayDevice"
+#define BAT0_PATH "/org/freedesktop/UPower/devices/battery_BAT0"
+#define BRIGHTD_BUS "net.iczelia.K16BrightD"
+#define BRIGHTD_PATH "/net/iczelia/K16BrightD"
+#define BRIGHTD_IFACE "net.iczelia.K16BrightD"
+#define DBUS_PROP_IF "org.freedesktop.DBus.Properties"
+
+#define STEPS_MAX 1024
+#define ENERGY_FULL_WH 57.0
+
+typedef struct {
+  int delay_ms;
+  uint32_t state; // UPower: 1 charging, 2 discharging, 4 fully charged
+  double percentage;
+  double energy_rate;
+} Step;
+
+static Step steps[STEPS_MAX];
+static int n_steps;
+static Step cur = {0, 2, 80.0, 9.5};
+
+static bool load_script(const char *path) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return false;
+  }
+  char line[256];
+  while (fgets(line, sizeof line, f) && n_steps < STEPS_MAX) {
+    line[strcspn(line, "#")] = '\0';
+    Step s;
+    if (sscanf(line, "%d %u %lf %lf", &s.delay_ms, &s.state, &s.percentage,
+               &s.energy_rate) == 4 &&
+        s.delay_ms >= 0)
+      steps[n_steps++] = s;
+  }
+  fclose(f);
+  if (n_steps == 0)
+    fprintf(stderr, "%s: no steps\n", path);
+  return n_steps > 0;
+}
+
+/* without a script: discharge by half a percent every 250 ms */
+static void default_script(void) {
+  for (n_steps = 0; n_steps < 100; ++n_steps)
+    steps[n_steps] = (Step){250, 2, 80.0 - n_steps * 0.5, 9.5};
+}
+
+static void add_entry(DBusMessageIter *dict, const char *key, int type,
+                      const void *value) {
+  char sig[2] = {(char)type, '\0'};
+  DBusMessageIter entry, var;
+  dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+  dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+  dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, sig, &var);
+  dbus_message_iter_append_basic(&var, type, value);
+  dbus_message_iter_close_container(&entry, &var);
+  dbus_message_iter_close_container(dict, &entry);
+}
+
+/* the properties of either device, as an a{sv} */
+static void append_props(DBusMessageIter *it, bool display, bool full) {
+  DBusMessageIter dict;
+  dbus_message_iter_open_container(it, DBUS_TYPE_ARRAY, "{sv}", &dict);
+  double energy = ENERGY_FULL_WH * cur.percentage / 100.0;
+  double energy_full = ENERGY_FULL_WH;
+  int64_t tte = cur.state == 2 && cur.energy_rate > 0
+                    ? (int64_t)(energy * 3600.0 / cur.energy_rate)
+                    : 0;
+  int64_t ttf = cur.state == 1 && cur.energy_rate > 0
+                    ? (int64_t)((energy_full - energy) * 3600.0 /
+                                cur.energy_rate)
+                    : 0;
+  add_entry(&dict, "Percentage", DBUS_TYPE_DOUBLE, &cur.percentage);
+  add_entry(&dict, "State", DBUS_TYPE_UINT32, &cur.state);
+  add_entry(&dict, "EnergyRate", DBUS_TYPE_DOUBLE, &cur.energy_rate);
+  add_entry(&dict, "Energy", DBUS_TYPE_DOUBLE, &energy);
+  add_entry(&dict, "TimeToEmpty", DBUS_TYPE_INT64, &tte);
+  add_entry(&dict, "TimeToFull", DBUS_TYPE_INT64, &ttf);
+  if (full) {
+    uint32_t type = 2; // battery
+    const char *model = display ? "" : "Bench Battery";
+    add_entry(&dict, "EnergyFull", DBUS_TYPE_DOUBLE, &energy_full);
+    add_entry(&dict, "Type", DBUS_TYPE_UINT32, &type);
+    add_entry(&dict, "Model", DBUS_TYPE_STRING, &model);
+  }
+  dbus_message_iter_close_container(it, &dict);
+}
+
+static void emit_changed(DBusConnection *conn, const char *path) {
+  DBusMessage *sig =
+      dbus_message_new_signal(path, DBUS_PROP_IF, "PropertiesChanged");
+  if (!sig)
+    return;
+  DBusMessageIter it, inval;
+  const char *iface = UPOWER_DEV_IF;
+  dbus_message_iter_init_append(sig, &it);
+  dbus_message_iter_append_basic(&it, DBUS_TYPE_STRING, &iface);
+  append_props(&it, strcmp(path, DISPLAY_PATH) == 0, false);
+  dbus_message_iter_open_container(&it, DBUS_TYPE_ARRAY, "s", &inval);
+  dbus_message_iter_close_container(&it, &inval);
+  dbus_connection_send(conn, sig, NULL);
+  dbus_message_unref(sig);
+}
+
+static DBusMessage *handle_upower(DBusMessage *m) {
+  DBusMessage *reply = NULL;
+  if (dbus_message_is_method_call(m, UPOWER_IFACE, "GetDisplayDevice")) {
+    const char *path = DISPLAY_PATH;
+    reply = dbus_message_new_method_return(m);
+    dbus_message_append_args(reply, DBUS_TYPE_OBJECT_PATH, &path,
+                             DBUS_TYPE_INVALID);
+  } else if (dbus_message_is_method_call(m, UPOWER_IFACE,
+                                         "EnumerateDevices")) {
+    const char *paths[] = {BAT0_PATH};
+    const char **p = paths;
+    reply = dbus_message_new_method_return(m);
+    dbus_message_append_args(reply, DBUS_TYPE_ARRAY, DBUS_TYPE_OBJECT_PATH,
+                             &p, 1, DBUS_TYPE_INVALID);
+  }
+  return reply;
+}
+
+static DBusMessage *handle_device(DBusMessage *m, bool display) {
+  if (!dbus_message_is_method_call(m, DBUS_PROP_IF, "GetAll"))
+    return NULL;
+  DBusMessage *reply = dbus_message_new_method_return(m);
+  DBusMessageIter it;
+  dbus_message_iter_init_append(reply, &it);
+  append_props(&it, display, true);
+  return reply;
+}
+
+/* SetBrightness(s, i) and SetGovernor(i, s): accept and do nothing */
+static DBusMessage *handle_brightd(DBusMessage *m) {
+  if (dbus_message_is_method_call(m, BRIGHTD_IFACE, "SetBrightness") ||
+      dbus_message_is_method_call(m, BRIGHTD_IFACE, "SetGovernor"))
+    return dbus_message_new_method_return(m);
+  return NULL;
+}
+
+static DBusHandlerResult on_message(DBusConnection *conn, DBusMessage *m,
+                                    void *user) {
+  (void)user;
+  if (dbus_message_get_type(m) != DBUS_MESSAGE_TYPE_METHOD_CALL)
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+  const char *path = dbus_message_get_path(m);
+  DBusMessage *reply = NULL;
+  if (!path)
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+  if (strcmp(path, UPOWER_PATH) == 0)
+    reply = handle_upower(m);
+  else if (strcmp(path, DISPLAY_PATH) == 0)
+    reply = handle_device(m, true);
+  else if (strcmp(path, BAT0_PATH) == 0)
+    reply = handle_device(m, false);
+  else if (strcmp(path, BRIGHTD_PATH) == 0)
+    reply = handle_brightd(m);
+  if (!reply)
+    reply = dbus_message_new_error(m, DBUS_ERROR_UNKNOWN_METHOD,
+                                   dbus_message_get_member(m));
+  dbus_connection_send(conn, reply, NULL);
+  dbus_message_unref(reply);
+  return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+static bool own(DBusConnection *conn, const char *name) {
+  DBusError err;
+  dbus_error_init(&err);
+  int rc = dbus_bus_request_name(conn, name, DBUS_NAME_FLAG_DO_NOT_QUEUE, &err);
+  if (rc != DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER) {
+    fprintf(stderr, "cannot own %s: %s\n", name,
+            dbus_error_is_set(&err) ? err.message : "already owned");
+    dbus_error_free(&err);
+    return false;
+  }
+  return true;
+}
+
+static long long now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int main(int argc, char *argv[]) {
+  long count = 0;
+  for (int i = 1; i < argc; ++i) {
+    if (strncmp(argv[i], "--script=", 9) == 0) {
+      if (!load_script(argv[i] + 9))
+        return 1;
+    } else if (strncmp(argv[i], "--count=", 8) == 0) {
+      count = atol(argv[i] + 8);
+    } else {
+      fprintf(stderr, "usage: %s [--script=FILE] [--count=N]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (n_steps == 0)
+    default_script();
+
+  DBusError err;
+  dbus_error_init(&err);
+  DBusConnection *conn = dbus_bus_get(DBUS_BUS_SYSTEM, &err);
+  if (!conn) {
+    fprintf(stderr, "bus: %s\n", err.message);
+    return 1;
+  }
+  dbus_connection_add_filter(conn, on_message, NULL, NULL);
+  if (!own(conn, UPOWER_BUS) || !own(conn, BRIGHTD_BUS))
+    return 1;
+  printf("ready\n");
+  fflush(stdout);
+
+  long sent = 0;
+  int step = 0;
+  long long due = now_ms() + steps[0].delay_ms;
+  while (count == 0 || sent < count) {
+    long long left = due - now_ms();
+    if (left > 0) {
+      if (!dbus_connection_read_write_dispatch(conn, (int)left))
+        return 0; // bus went away
+      continue;
+    }
+    const Step *s = &steps[step];
+    cur = *s;
+    emit_changed(conn, DISPLAY_PATH);
+    if (step % 4 == 0)
+      emit_changed(conn, BAT0_PATH);
+    dbus_connection_flush(conn);
+    ++sent;
+    step = (step + 1) % n_steps;
+    due += steps[step].delay_ms;
+  }
+  // let the last replies go out before leaving
+  while (dbus_connection_read_write_dispatch(conn, 500) &&
+         dbus_connection_get_dispatch_status(conn) ==
+             DBUS_DISPATCH_DATA_REMAINS)
+    ;
+  return 0;
+}
@@ -5,6 +5,7 @@
 #include <X11/Xutil.h>
 #include <X11/Xatom.h>
 #include <X11/extensions/Xrender.h>
+#include <X11/extensions/sync.h>
 #include <X11/Xft/Xft.h>
 #include <X11/keysym.h>
 #include <X11/XF86keysym.h>
@@ -18,6 +19,7 @@
 #include <dbus/dbus.h>
 #include <png.h>
 
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -33,6 +35,14 @@
 #include <sys/wait.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <linux/netlink.h>
+#include <linux/filter.h>
+#include <sys/un.h>
+#include <sys/syscall.h>
+#include <signal.h>
 
 #ifndef PATH_MAX
 #define PATH_MAX 4096
@@ -68,6 +78,10 @@
 #define UPOWER_IFACE "org.freedesktop.UPower"
 #define UPOWER_DEV_IF "org.freedesktop.UPower.Device"
 #define DBUS_PROP_IF "org.freedesktop.DBus.Properties"
+#define UPOWER_DISPLAY_PATH "/org/freedesktop/UPower/devices/DisplayDevice"
+
+// Upper bound for any UPower round trip, blocking or not.
+#define UPOWER_TIMEOUT_MS 2000
 
 #define BRIGHTD_BUS "net.iczelia.K16BrightD"
 #define BRIGHTD_PATH "/net/iczelia/K16BrightD"
@@ -79,6 +93,10 @@ typedef struct {
   uint32_t state;     // enum
   int64_t tte;        // seconds
   int64_t ttf;        // seconds
+  double energy;      // Wh, 0 if not reported
+  double energy_full; // Wh
+  int64_t eta;        // seconds to empty/full from our own estimate, or
+                      // UPower's; <= 0 if unknown
   bool valid;
 } BatteryInfo;
 
@@ -91,7 +109,18 @@ typedef struct {
   bool have_fan;
 } CpuInfo;
 
-static void send_notification(const char *msg);
+typedef enum { NOTIF_NORMAL = 0, NOTIF_CRITICAL = 1 } NotifUrgency;
+
+static void send_notification(const char *msg, NotifUrgency urgency);
+
+typedef enum { RAPL_PACKAGE, RAPL_CORE, RAPL_DRAM, RAPL_KINDS } RaplKind;
+
+typedef struct {
+  double watts[RAPL_KINDS]; // summed over sockets
+  bool have[RAPL_KINDS];
+  double package_avg; // package power over the short window
+  bool have_avg;
+} PowerInfo;
 
 typedef struct {
   int level;    // raw brightness value
@@ -109,11 +138,124 @@ typedef struct {
   bool has_original;
 } GovernorState;
 
+// UPower device kinds we care about (org.freedesktop.UPower.Device.Type)
+#define UP_KIND_LINE_POWER 1
+#define UP_KIND_BATTERY 2
+
+#define UP_DEVICES_MAX 32
+#define UP_DEVICE_SLOTS 64 // open addressing, power of two
+
+typedef enum { SLOT_EMPTY = 0, SLOT_USED, SLOT_DELETED } SlotState;
+
+typedef struct {
+  SlotState state;
+  uint32_t hash;
+  char path[128];
+  bool is_display; // composite device, mirrored into the main BatteryInfo
+  uint32_t kind;
+  char model[48];
+  BatteryInfo info;
+  bool changed; // row needs repainting
+  int row;      // row index from the last full draw, -1 if not shown
+} UpDevice;
+
+typedef struct {
+  UpDevice slots[UP_DEVICE_SLOTS];
+  int count;
+} UpDeviceTable;
+
+static UpDeviceTable up_devices;
+
+static uint32_t path_hash(const char *s) {
+  uint32_t h = 2166136261u; // FNV-1a
+  for (; *s; ++s) {
+    h ^= (unsigned char)*s;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static UpDevice *device_lookup(const char *path) {
+  uint32_t h = path_hash(path);
+  for (uint32_t i = 0; i < UP_DEVICE_SLOTS; ++i) {
+    UpDevice *d = &up_devices.slots[(h + i) & (UP_DEVICE_SLOTS - 1)];
+    if (d->state == SLOT_EMPTY)
+      return NULL;
+    if (d->state == SLOT_USED && d->hash == h && strcmp(d->path, path) == 0)
+      return d;
+  }
+  return NULL;
+}
+
+static UpDevice *device_insert(const char *path) {
+  UpDevice *d = device_lookup(path);
+  if (d)
+    return d;
+  if (up_devices.count >= UP_DEVICES_MAX ||
+      strlen(path) >= sizeof d->path)
+    return NULL;
+  uint32_t h = path_hash(path);
+  for (uint32_t i = 0; i < UP_DEVICE_SLOTS; ++i) {
+    d = &up_devices.slots[(h + i) & (UP_DEVICE_SLOTS - 1)];
+    if (d->state == SLOT_USED)
+      continue;
+    memset(d, 0, sizeof *d);
+    d->state = SLOT_USED;
+    d->hash = h;
+    d->row = -1;
+    snprintf(d->path, sizeof d->path, "%s", path);
+    ++up_devices.count;
+    return d;
+  }
+  return NULL;
+}
+
+static void device_remove(const char *path) {
+  UpDevice *d = device_lookup(path);
+  if (!d)
+    return;
+  d->state = SLOT_DELETED;
+  --up_devices.count;
+}
+
+static void device_clear_all(void) {
+  memset(&up_devices, 0, sizeof up_devices);
+}
+
+/* devices that get a row of their own; a lone laptop battery is already
+ * what the composite DisplayDevice shows */
+static bool device_has_row(const UpDevice *d) {
+  if (d->state != SLOT_USED || d->is_display || !d->info.valid)
+    return false;
+  if (d->kind == UP_KIND_LINE_POWER)
+    return false;
+  if (d->kind == UP_KIND_BATTERY) {
+    int batteries = 0;
+    for (int i = 0; i < UP_DEVICE_SLOTS; ++i) {
+      const UpDevice *o = &up_devices.slots[i];
+      if (o->state == SLOT_USED && !o->is_display &&
+          o->kind == UP_KIND_BATTERY)
+        ++batteries;
+    }
+    return batteries > 1;
+  }
+  return true;
+}
+
+static const char *device_kind_str(uint32_t kind) {
+  static const char *names[] = {
+      "Device",   "AC",      "Battery",  "UPS",      "Monitor",
+      "Mouse",    "Keyboard", "PDA",     "Phone",    "Player",
+      "Tablet",   "Computer", "Gamepad", "Pen",      "Touchpad",
+      "Modem",    "Network",  "Headset", "Speakers", "Headphones"};
+  if (kind < sizeof names / sizeof names[0])
+    return names[kind];
+  return "Device";
+}
+
 static GovernorState *governor_states = NULL;
 static int governor_states_count = 0;
-static bool powersave_active = false;
-static bool powersave_threshold_enabled = false;
-static double powersave_threshold = -1.0;
+static bool powersave_active = false; // governors overridden by the policy
 static GovernorInfo governor_info = {0};
 
 #define EDIT_BUFFER_MAX 16
@@ -157,16 +299,351 @@ typedef struct {
 
   int dragging;
   int drag_off_x, drag_off_y;
+
+  // visibility tracking; cosmetic work is suspended while not visible
+  Atom net_wm_state;
+  Atom net_wm_state_hidden;
+  bool mapped;
+  bool hidden;
+  bool obscured;
+
+  int rows_y; // baseline of the first per-device row
 } Ui;
 
+// Line height of the text rows and the minimum window height.
+#define ROW_H 16
+#define MIN_WIN_H 110
+
+// Sensor refresh period while the window is visible.
+#define SENSOR_POLL_MS 2000
+// Timer slack requested from the kernel so our remaining timers coalesce
+// with other wakeups instead of firing on their own.
+#define TIMER_SLACK_NS 50000000UL
+
 static char cpu_freq_path[PATH_MAX];
-static char cpu_temp_path[PATH_MAX];
-static char fan_speed_path[PATH_MAX];
 static char brightness_path[PATH_MAX];
 static char max_brightness_path[PATH_MAX];
 
 static double double_abs(double x) { return (x < 0.0) ? -x : x; }
 
+static long elapsed_ms(const struct timespec *from, const struct timespec *to) {
+  return (long)(to->tv_sec - from->tv_sec) * 1000L +
+         (to->tv_nsec - from->tv_nsec) / 1000000L;
+}
+
+/* milliseconds until `last + period_ms`; 0 if due or never polled */
+static long ms_until_due(const struct timespec *last,
+                         const struct timespec *now, long period_ms) {
+  if (last->tv_sec == 0 && last->tv_nsec == 0)
+    return 0;
+  long left = period_ms - elapsed_ms(last, now);
+  return left > 0 ? left : 0;
+}
+
+/* lower a poll() timeout (-1 = infinite) to at most `ms` */
+static void timeout_min(int *timeout, long ms) {
+  if (ms < 0)
+    return;
+  if (ms > INT_MAX)
+    ms = INT_MAX;
+  if (*timeout < 0 || ms < *timeout)
+    *timeout = (int)ms;
+}
+
+/* Every sysfs path is built under a configurable root (--sysfs-root), so
+ * a fake tree can stand in for real hardware. */
+static char sysfs_root[PATH_MAX] = "/sys";
+
+static void sysfs_path(char *out, size_t n, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+static void sysfs_path(char *out, size_t n, const char *fmt, ...) {
+  int len = snprintf(out, n, "%s", sysfs_root);
+  if (len < 0 || (size_t)len >= n)
+    return;
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(out + len, n - (size_t)len, fmt, ap);
+  va_end(ap);
+}
+
+/* --bench[=MS]: main loop measurements, reported on stderr once a minute
+ * (or every MS). Latency runs from the first UPower signal not yet on
+ * screen to the end of the frame that shows it, including an XSync so the
+ * server has processed the frame. Only read()/write()-family syscalls can
+ * be counted from inside the process (/proc/self/io); poll, recvmsg,
+ * sendmsg and the like are not included. bench.sh drives this against
+ * stub services and a fake sysfs tree. */
+#define BENCH_SAMPLES 256
+#define BENCH_REPORT_MS 60000
+
+static bool bench_enabled = false;
+static long bench_period_ms = BENCH_REPORT_MS;
+static struct {
+  struct timespec start; // of the current report period
+  unsigned long wakeups; // poll() returns
+  unsigned long frames;
+  unsigned long x_requests;
+  unsigned long long io_calls; // syscr + syscw at the start of the period
+  struct timespec signal_t;
+  bool signal_pending;
+  long latency_us[BENCH_SAMPLES];
+  int n_latency;
+} bench;
+
+static void bench_signal(void) {
+  if (!bench_enabled || bench.signal_pending)
+    return;
+  clock_gettime(CLOCK_MONOTONIC, &bench.signal_t);
+  bench.signal_pending = true;
+}
+
+static void bench_frame(unsigned long x_requests) {
+  if (!bench_enabled)
+    return;
+  ++bench.frames;
+  bench.x_requests += x_requests;
+  if (!bench.signal_pending)
+    return;
+  bench.signal_pending = false;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (bench.n_latency < BENCH_SAMPLES)
+    bench.latency_us[bench.n_latency++] =
+        (long)(now.tv_sec - bench.signal_t.tv_sec) * 1000000L +
+        (now.tv_nsec - bench.signal_t.tv_nsec) / 1000L;
+}
+
+/* Signals are dispatched at the top of a loop pass and drawn before its
+ * end, so one that made no frame by then (nothing visible changed, or the
+ * window is hidden) never will; don't pair it with some later frame. */
+static void bench_end_pass(void) { bench.signal_pending = false; }
+
+/* close a frame whose first request was `first_request` */
+static void bench_end_frame(Display *dpy, unsigned long first_request) {
+  if (!bench_enabled)
+    return;
+  unsigned long requests = NextRequest(dpy) - first_request;
+  XSync(dpy, False);
+  bench_frame(requests);
+}
+
+/* read()/write()-family syscalls so far, from /proc/self/io */
+static unsigned long long bench_io_calls(void) {
+  FILE *f = fopen("/proc/self/io", "r");
+  if (!f)
+    return 0;
+  char line[64];
+  unsigned long long total = 0, v;
+  while (fgets(line, sizeof line, f)) {
+    if (sscanf(line, "syscr: %llu", &v) == 1 ||
+        sscanf(line, "syscw: %llu", &v) == 1)
+      total += v;
+  }
+  fclose(f);
+  return total;
+}
+
+static int cmp_long(const void *a, const void *b) {
+  long x = *(const long *)a, y = *(const long *)b;
+  return (x > y) - (x < y);
+}
+
+static void bench_report(const struct timespec *now) {
+  long period = elapsed_ms(&bench.start, now);
+  unsigned long long io = bench_io_calls();
+  if (bench.start.tv_sec != 0 && period > 0) {
+    long p50 = 0, p90 = 0, p99 = 0;
+    if (bench.n_latency > 0) {
+      qsort(bench.latency_us, (size_t)bench.n_latency, sizeof(long),
+            cmp_long);
+      p50 = bench.latency_us[bench.n_latency * 50 / 100];
+      p90 = bench.latency_us[bench.n_latency * 90 / 100];
+      p99 = bench.latency_us[bench.n_latency * 99 / 100];
+    }
+    fprintf(stderr,
+            "bench: %.1f wakeups/min, %.1f read/write syscalls/cycle, "
+            "%lu frames, %.1f X requests/frame, signal->frame p50 %.2f "
+            "p90 %.2f p99 %.2f ms (n=%d)\n",
+            bench.wakeups * 60000.0 / (double)period,
+            bench.wakeups ? (double)(io - bench.io_calls) / bench.wakeups : 0.0,
+            bench.frames,
+            bench.frames ? (double)bench.x_requests / bench.frames : 0.0,
+            p50 / 1000.0, p90 / 1000.0, p99 / 1000.0, bench.n_latency);
+  }
+  bench.start = *now;
+  bench.wakeups = bench.frames = bench.x_requests = 0;
+  bench.n_latency = 0;
+  bench.io_calls = bench_io_calls(); // exclude our own reads of it
+}
+
+/* Runtime statistics, always on. Durations go into log-linear
+ * histograms (four sub-buckets per power of two of nanoseconds), counts
+ * into plain counters; recording is a clock read and an increment, with
+ * no allocation. x11power is single-threaded, so the tables are simply
+ * static. 's' toggles an overlay, SIGUSR1 dumps everything to stderr. */
+typedef enum {
+  STAT_READ_CPU,
+  STAT_READ_BRIGHTNESS,
+  STAT_FETCH_PROPS,
+  STAT_UI_DRAW,
+  STAT_DBUS_CALL, // every blocking round trip
+  STAT_TIMERS
+} StatTimer;
+
+typedef enum {
+  STAT_LOOPS,
+  STAT_WAKE_X,
+  STAT_WAKE_DBUS,
+  STAT_WAKE_TIMEOUT,
+  STAT_WAKE_OTHER, // uevent, PSI, notifier socket, signals
+  STAT_SKIP_CPU,   // samples equal to what is on screen
+  STAT_SKIP_POWER,
+  STAT_SKIP_BRIGHTNESS,
+  STAT_SKIP_GOVERNOR,
+  STAT_REDRAWS,
+  STAT_COUNTERS
+} StatCounter;
+
+#define STAT_BUCKETS 252 // covers the whole uint64_t range
+
+typedef struct {
+  uint64_t count;
+  uint64_t sum_ns;
+  uint64_t max_ns;
+  uint32_t buckets[STAT_BUCKETS];
+} StatHistogram;
+
+static const char *const stat_timer_names[STAT_TIMERS] = {
+    "read_cpu_info", "read_brightness", "fetch_props", "ui_draw", "dbus_call"};
+static const char *const stat_counter_names[STAT_COUNTERS] = {
+    "loops",         "wake_x",         "wake_dbus",         "wake_timeout",
+    "wake_other",    "skip_cpu",       "skip_power",        "skip_brightness",
+    "skip_governor", "redraws"};
+
+static StatHistogram stat_hist[STAT_TIMERS];
+static uint64_t stat_counters[STAT_COUNTERS];
+static bool stats_shown = false;
+
+static uint64_t stat_now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000000u + (uint64_t)t.tv_nsec;
+}
+
+static int stat_bucket(uint64_t ns) {
+  if (ns < 4)
+    return (int)ns;
+  int e = 63 - __builtin_clzll(ns); // >= 2
+  return 4 * (e - 1) + (int)((ns >> (e - 2)) & 3);
+}
+
+/* smallest value that lands in the bucket after `i` */
+static uint64_t stat_bucket_limit(int i) {
+  ++i;
+  if (i < 4)
+    return (uint64_t)i;
+  int e = i / 4 + 1;
+  return (uint64_t)(4 + i % 4) << (e - 2);
+}
+
+static void stat_record(StatTimer id, uint64_t start_ns) {
+  uint64_t ns = stat_now() - start_ns;
+  StatHistogram *h = &stat_hist[id];
+  ++h->count;
+  h->sum_ns += ns;
+  if (ns > h->max_ns)
+    h->max_ns = ns;
+  ++h->buckets[stat_bucket(ns)];
+}
+
+static void stat_count(StatCounter id) { ++stat_counters[id]; }
+
+/* upper bound of the bucket holding the q-th quantile */
+static uint64_t stat_quantile(const StatHistogram *h, double q) {
+  if (h->count == 0)
+    return 0;
+  uint64_t rank = (uint64_t)(q * (double)(h->count - 1)) + 1;
+  uint64_t seen = 0;
+  for (int i = 0; i < STAT_BUCKETS; ++i) {
+    seen += h->buckets[i];
+    if (seen >= rank) {
+      uint64_t limit = stat_bucket_limit(i);
+      return limit < h->max_ns ? limit : h->max_ns;
+    }
+  }
+  return h->max_ns;
+}
+
+static void fmt_ns(char *out, size_t n, uint64_t ns) {
+  if (ns < 10000)
+    snprintf(out, n, "%lluns", (unsigned long long)ns);
+  else if (ns < 10000000)
+    snprintf(out, n, "%.1fus", (double)ns / 1e3);
+  else
+    snprintf(out, n, "%.1fms", (double)ns / 1e6);
+}
+
+/* one line per timer: "name n=.. p50 .. p99 .. max .." */
+static void stat_format_timer(StatTimer id, char *out, size_t n) {
+  const StatHistogram *h = &stat_hist[id];
+  char p50[16], p99[16], max[16];
+  fmt_ns(p50, sizeof p50, stat_quantile(h, 0.50));
+  fmt_ns(p99, sizeof p99, stat_quantile(h, 0.99));
+  fmt_ns(max, sizeof max, h->max_ns);
+  snprintf(out, n, "%s n=%llu p50 %s p99 %s max %s", stat_timer_names[id],
+           (unsigned long long)h->count, p50, p99, max);
+}
+
+static void stat_dump(FILE *f) {
+  char line[128];
+  fprintf(f, "x11power stats:\n");
+  for (int i = 0; i < STAT_TIMERS; ++i) {
+    stat_format_timer((StatTimer)i, line, sizeof line);
+    fprintf(f, "  %s\n", line);
+  }
+  for (int i = 0; i < STAT_COUNTERS; ++i)
+    fprintf(f, "  %s %llu\n", stat_counter_names[i],
+            (unsigned long long)stat_counters[i]);
+}
+
+/* SIGUSR1 only writes to a pipe the main loop polls */
+static int stats_pipe[2] = {-1, -1};
+
+static void stats_signal_handler(int sig) {
+  (void)sig;
+  int saved = errno;
+  char c = 1;
+  if (write(stats_pipe[1], &c, 1) < 0) {
+    // pipe full: a dump is already pending
+  }
+  errno = saved;
+}
+
+static int stats_install_signal(void) {
+  if (pipe(stats_pipe) != 0)
+    return -1;
+  for (int i = 0; i < 2; ++i) {
+    fcntl(stats_pipe[i], F_SETFD, FD_CLOEXEC);
+    fcntl(stats_pipe[i], F_SETFL, O_NONBLOCK);
+  }
+  struct sigaction sa = {0};
+  sa.sa_handler = stats_signal_handler;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;
+  sigaction(SIGUSR1, &sa, NULL);
+  return stats_pipe[0];
+}
+
+static DBusMessage *dbus_call_blocking(DBusConnection *conn, DBusMessage *msg,
+                                       int timeout_ms, DBusError *err) {
+  uint64_t t0 = stat_now();
+  DBusMessage *reply =
+      dbus_connection_send_with_reply_and_block(conn, msg, timeout_ms, err);
+  stat_record(STAT_DBUS_CALL, t0);
+  return reply;
+}
+
 static bool str_contains_ci(const char *haystack, const char *needle) {
   if (!haystack || !needle || !*needle)
     return false;
@@ -229,16 +706,18 @@ static bool detect_cpu_freq_path(char *out, size_t n) {
   if (!out || n == 0)
     return false;
   const char *candidates[] = {
-      "/sys/devices/system/cpu/cpu0/cpufreq/scaling_cur_freq",
-      "/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_cur_freq",
-      "/sys/devices/system/cpu/cpufreq/policy0/scaling_cur_freq",
-      "/sys/devices/system/cpu/cpufreq/policy0/cpuinfo_cur_freq",
+      "/devices/system/cpu/cpu0/cpufreq/scaling_cur_freq",
+      "/devices/system/cpu/cpu0/cpufreq/cpuinfo_cur_freq",
+      "/devices/system/cpu/cpufreq/policy0/scaling_cur_freq",
+      "/devices/system/cpu/cpufreq/policy0/cpuinfo_cur_freq",
       NULL};
   for (size_t i = 0; candidates[i]; ++i) {
-    FILE *f = fopen(candidates[i], "r");
+    char path[PATH_MAX];
+    sysfs_path(path, sizeof path, "%s", candidates[i]);
+    FILE *f = fopen(path, "r");
     if (f) {
       fclose(f);
-      snprintf(out, n, "%s", candidates[i]);
+      snprintf(out, n, "%s", path);
       return true;
     }
   }
@@ -295,140 +774,827 @@ static bool read_cpu_frequency(double *out_mhz) {
   return read_cpu_frequency_from_proc(out_mhz);
 }
 
-static bool detect_cpu_temp_path(char *out, size_t n) {
-  if (!out || n == 0)
+typedef enum { SENSOR_TEMP, SENSOR_FAN } SensorKind;
+
+typedef struct {
+  SensorKind kind;
+  int fd;        // kept open; re-read with pread()
+  bool cpu;      // part of the CPU temperature aggregate
+  bool degraded; // last read failed; skipped until it reads again
+  char label[32];
+} Sensor;
+
+#define SENSORS_MAX 64
+
+static Sensor sensors[SENSORS_MAX];
+static int sensor_count = 0;
+
+static bool read_line_from_file(const char *path, char *out, size_t n) {
+  FILE *f = fopen(path, "r");
+  if (!f)
     return false;
-  const char *keywords[] = {"cpu", "package", "x86_pkg_temp", "soc", NULL};
-  char type_path[PATH_MAX];
-  char temp_path[PATH_MAX];
-  for (int i = 0; i < 32; ++i) {
-    snprintf(type_path, sizeof type_path,
-             "/sys/class/thermal/thermal_zone%d/type", i);
-    FILE *f = fopen(type_path, "r");
-    if (!f)
-      continue;
-    char buf[128];
-    if (!fgets(buf, sizeof buf, f)) {
-      fclose(f);
+  bool ok = fgets(out, (int)n, f) != NULL;
+  fclose(f);
+  if (ok)
+    out[strcspn(out, "\r\n")] = '\0';
+  return ok;
+}
+
+static bool is_cpu_sensor_name(const char *name) {
+  const char *keywords[] = {"cpu",  "package", "x86_pkg_temp", "soc",
+                            "core", "tctl",    "tdie",         "coretemp",
+                            "k10temp", "zenpower", NULL};
+  for (size_t k = 0; keywords[k]; ++k) {
+    if (str_contains_ci(name, keywords[k]))
+      return true;
+  }
+  return false;
+}
+
+static void add_sensor(SensorKind kind, const char *path, const char *label,
+                       bool cpu) {
+  if (sensor_count >= SENSORS_MAX)
+    return;
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return;
+  Sensor *s = &sensors[sensor_count++];
+  s->kind = kind;
+  s->fd = fd;
+  s->cpu = cpu;
+  s->degraded = false;
+  snprintf(s->label, sizeof s->label, "%s", label);
+}
+
+static void scan_hwmon_dir(const char *dir_path) {
+  char name[64] = "";
+  char path[PATH_MAX];
+  snprintf(path, sizeof path, "%s/name", dir_path);
+  read_line_from_file(path, name, sizeof name);
+  bool cpu_chip = is_cpu_sensor_name(name);
+
+  DIR *dir = opendir(dir_path);
+  if (!dir)
+    return;
+  struct dirent *ent;
+  while ((ent = readdir(dir)) != NULL) {
+    int idx = 0;
+    char tail[16];
+    SensorKind kind;
+    if (sscanf(ent->d_name, "temp%d_%15s", &idx, tail) == 2 &&
+        strcmp(tail, "input") == 0)
+      kind = SENSOR_TEMP;
+    else if (sscanf(ent->d_name, "fan%d_%15s", &idx, tail) == 2 &&
+             strcmp(tail, "input") == 0)
+      kind = SENSOR_FAN;
+    else
       continue;
+    char label[32];
+    snprintf(label, sizeof label, "%s", name);
+    snprintf(path, sizeof path, "%s/%s%d_label", dir_path,
+             kind == SENSOR_TEMP ? "temp" : "fan", idx);
+    char chan[32];
+    if (read_line_from_file(path, chan, sizeof chan))
+      snprintf(label, sizeof label, "%s", chan);
+    snprintf(path, sizeof path, "%s/%s", dir_path, ent->d_name);
+    add_sensor(kind, path, label,
+               kind == SENSOR_TEMP && (cpu_chip || is_cpu_sensor_name(label)));
+  }
+  closedir(dir);
+}
+
+static void close_sensors(void) {
+  for (int i = 0; i < sensor_count; ++i)
+    close(sensors[i].fd);
+  sensor_count = 0;
+}
+
+/* one pass over hwmon and thermal zones; re-run only on hwmon uevents */
+static void discover_sensors(void) {
+  close_sensors();
+  char path[PATH_MAX];
+  sysfs_path(path, sizeof path, "/class/hwmon");
+  DIR *dir = opendir(path);
+  if (dir) {
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+      if (strncmp(ent->d_name, "hwmon", 5) != 0)
+        continue;
+      sysfs_path(path, sizeof path, "/class/hwmon/%s", ent->d_name);
+      scan_hwmon_dir(path);
     }
-    fclose(f);
-    buf[strcspn(buf, "\r\n")] = '\0';
-    bool match = false;
-    for (size_t k = 0; keywords[k]; ++k) {
-      if (str_contains_ci(buf, keywords[k])) {
-        match = true;
+    closedir(dir);
+  }
+
+  bool have_cpu_temp = false;
+  bool have_fan = false;
+  for (int i = 0; i < sensor_count; ++i) {
+    have_cpu_temp |= sensors[i].cpu;
+    have_fan |= sensors[i].kind == SENSOR_FAN;
+  }
+
+  // thermal zones duplicate hwmon on most machines; only use them when no
+  // CPU chip was found there
+  sysfs_path(path, sizeof path, "/class/thermal");
+  if (!have_cpu_temp && (dir = opendir(path)) != NULL) {
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+      if (strncmp(ent->d_name, "thermal_zone", 12) != 0)
+        continue;
+      char type[64];
+      sysfs_path(path, sizeof path, "/class/thermal/%s/type", ent->d_name);
+      if (!read_line_from_file(path, type, sizeof type) ||
+          !is_cpu_sensor_name(type))
+        continue;
+      sysfs_path(path, sizeof path, "/class/thermal/%s/temp", ent->d_name);
+      add_sensor(SENSOR_TEMP, path, type, true);
+      have_cpu_temp = true;
+    }
+    closedir(dir);
+  }
+
+  // last resort: whatever temperature there is stands in for the CPU
+  if (!have_cpu_temp) {
+    for (int i = 0; i < sensor_count; ++i) {
+      if (sensors[i].kind == SENSOR_TEMP) {
+        sensors[i].cpu = true;
         break;
       }
     }
-    if (!match)
-      continue;
-    snprintf(temp_path, sizeof temp_path,
-             "/sys/class/thermal/thermal_zone%d/temp", i);
-    FILE *tf = fopen(temp_path, "r");
-    if (tf) {
-      fclose(tf);
-      snprintf(out, n, "%s", temp_path);
-      return true;
-    }
   }
-  const char *fallbacks[] = {"/sys/class/thermal/thermal_zone0/temp",
-                              "/sys/class/hwmon/hwmon0/temp1_input", NULL};
-  for (size_t i = 0; fallbacks[i]; ++i) {
-    FILE *f = fopen(fallbacks[i], "r");
-    if (f) {
-      fclose(f);
-      snprintf(out, n, "%s", fallbacks[i]);
-      return true;
+
+  if (!have_fan) {
+    const char *fallbacks[] = {
+        "/devices/platform/applesmc.768/fan1_input",
+        "/devices/platform/thinkpad_hwmon/hwmon/hwmon0/fan1_input", NULL};
+    for (size_t i = 0; fallbacks[i]; ++i) {
+      sysfs_path(path, sizeof path, "%s", fallbacks[i]);
+      add_sensor(SENSOR_FAN, path, "fan", false);
     }
   }
-  out[0] = '\0';
-  return false;
+}
+
+static bool read_sensor(Sensor *s, double *out) {
+  char buf[32];
+  ssize_t n = pread(s->fd, buf, sizeof buf - 1, 0);
+  if (n <= 0) {
+    s->degraded = true;
+    return false;
+  }
+  buf[n] = '\0';
+  errno = 0;
+  char *end = NULL;
+  double val = strtod(buf, &end);
+  if (end == buf || errno == ERANGE) {
+    s->degraded = true;
+    return false;
+  }
+  s->degraded = false;
+  *out = val;
+  return true;
+}
+
+/* maximum over all sensors of `kind` (and `cpu` for temperatures) */
+static bool read_sensor_max(SensorKind kind, double *out) {
+  bool any = false;
+  double best = 0.0;
+  for (int i = 0; i < sensor_count; ++i) {
+    Sensor *s = &sensors[i];
+    if (s->kind != kind || (kind == SENSOR_TEMP && !s->cpu))
+      continue;
+    double v = 0.0;
+    if (!read_sensor(s, &v))
+      continue;
+    if (kind == SENSOR_TEMP && v > 1000.0)
+      v /= 1000.0;
+    if (v < 0.0)
+      continue;
+    if (!any || v > best)
+      best = v;
+    any = true;
+  }
+  if (any)
+    *out = best;
+  return any;
 }
 
 static bool read_cpu_temperature(double *out_c) {
   if (!out_c)
     return false;
-  if (!cpu_temp_path[0])
-    detect_cpu_temp_path(cpu_temp_path, sizeof cpu_temp_path);
-  if (!cpu_temp_path[0])
+  return read_sensor_max(SENSOR_TEMP, out_c);
+}
+
+static bool read_fan_speed(double *out_rpm) {
+  if (!out_rpm)
+    return false;
+  return read_sensor_max(SENSOR_FAN, out_rpm);
+}
+
+/* The kernel broadcasts every uevent (USB, block, net, input, power
+ * supply...) to the group, and only hwmon ones matter here, so a socket
+ * filter drops the rest before they wake us. Classic BPF can't loop or
+ * jump backwards: the program is unrolled over the first `span` bytes,
+ * two instructions per offset to spot the word "SUBS" and two more to
+ * hand the offset in X to a shared tail that checks the rest of
+ * "SUBSYSTEM=hwmon\0". A "SUBS" that isn't the SUBSYSTEM key (say,
+ * inside DEVPATH) is let through rather than ending the scan, as are
+ * messages longer than the span; uevent_touches_hwmon sorts those out.
+ * Reading past the end of a shorter message drops it. */
+#define UEVENT_FILTER_SPAN 512
+
+static struct sock_filter uevent_filter[UEVENT_FILTER_SPAN * 4 + 12];
+
+static int build_uevent_filter(uint32_t span) {
+  struct sock_filter *op = uevent_filter;
+  for (uint32_t off = 0; off < span; ++off) {
+    *op++ = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, off);
+    *op++ = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+                                         0x53554253, 0, 2); // "SUBS"
+    *op++ = (struct sock_filter)BPF_STMT(BPF_LDX | BPF_IMM, off);
+    *op++ = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JA,
+                                         4 * (span - off - 1) + 1, 0, 0);
+  }
+  const struct sock_filter tail[] = {
+      BPF_STMT(BPF_RET | BPF_K, 0xffffffffu), // no "SUBS" in the span
+      BPF_STMT(BPF_LD | BPF_W | BPF_IND, 4),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x59535445, 0, 6), // "YSTE"
+      BPF_STMT(BPF_LD | BPF_W | BPF_IND, 8),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x4d3d6877, 0, 2), // "M=hw"
+      BPF_STMT(BPF_LD | BPF_W | BPF_IND, 12),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x6d6f6e00, 3, 4), // "mon\0"
+      BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0xffff0000u),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x4d3d0000, 2, 0), // "M=": other
+      BPF_STMT(BPF_RET | BPF_K, 0xffffffffu), // not the SUBSYSTEM key
+      BPF_STMT(BPF_RET | BPF_K, 0xffffffffu), // hwmon
+      BPF_STMT(BPF_RET | BPF_K, 0),           // another subsystem
+  };
+  memcpy(op, tail, sizeof tail);
+  return (int)(op - uevent_filter) + (int)(sizeof tail / sizeof tail[0]);
+}
+
+static void attach_uevent_filter(int fd) {
+  // the kernel charges filters against net.core.optmem_max, which is
+  // small on older kernels: fall back to shorter spans
+  for (uint32_t span = UEVENT_FILTER_SPAN; span >= 64; span /= 2) {
+    struct sock_fprog prog = {
+        .len = (unsigned short)build_uevent_filter(span),
+        .filter = uevent_filter};
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof prog) == 0)
+      return;
+    if (errno != ENOMEM)
+      break;
+  }
+  // not fatal: every uevent still arrives, and is just filtered later
+  fprintf(stderr, "uevent filter: %s\n", strerror(errno));
+}
+
+/* kernel uevents, used to notice hwmon chips coming and going */
+static int open_uevent_socket(void) {
+  int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                  NETLINK_KOBJECT_UEVENT);
+  if (fd < 0)
+    return -1;
+  // before bind, so nothing unfiltered gets queued in between
+  attach_uevent_filter(fd);
+  struct sockaddr_nl addr = {0};
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = 1; // kernel broadcast group
+  if (bind(fd, (struct sockaddr *)&addr, sizeof addr) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/* drain pending uevents; true if any concerned the hwmon subsystem */
+static bool uevent_touches_hwmon(int fd) {
+  char buf[4096];
+  bool hit = false;
+  for (;;) {
+    ssize_t n = recv(fd, buf, sizeof buf - 1, 0);
+    if (n <= 0)
+      break;
+    buf[n] = '\0';
+    for (ssize_t off = 0; off < n; off += (ssize_t)strlen(buf + off) + 1) {
+      if (strcmp(buf + off, "SUBSYSTEM=hwmon") == 0)
+        hit = true;
+    }
+  }
+  return hit;
+}
+
+/* RAPL energy counters from the powercap class. Counters are cumulative
+ * microjoules that wrap at max_energy_range_uj. */
+typedef struct {
+  RaplKind kind;
+  int fd;
+  uint64_t max_range_uj;
+  uint64_t last_uj;
+  bool primed;
+} RaplDomain;
+
+#define RAPL_DOMAINS_MAX 16
+// samples kept for the package average; at the sensor cadence about 10 s
+#define RAPL_WINDOW 6
+
+static char powercap_root[PATH_MAX]; // default: <sysfs root>/class/powercap
+static RaplDomain rapl[RAPL_DOMAINS_MAX];
+static int rapl_count = 0;
+static struct timespec rapl_last_t;
+// cumulative package energy and its timestamps, for the windowed average
+static double rapl_window_j[RAPL_WINDOW];
+static struct timespec rapl_window_t[RAPL_WINDOW];
+static int rapl_window_len = 0;
+static int rapl_window_head = 0;
+static double rapl_package_j = 0.0;
+
+static bool read_u64_fd(int fd, uint64_t *out) {
+  char buf[32];
+  ssize_t n = pread(fd, buf, sizeof buf - 1, 0);
+  if (n <= 0)
     return false;
-  double raw = 0.0;
-  if (!read_double_from_file(cpu_temp_path, &raw)) {
-    cpu_temp_path[0] = '\0';
+  buf[n] = '\0';
+  errno = 0;
+  char *end = NULL;
+  unsigned long long v = strtoull(buf, &end, 10);
+  if (end == buf || errno == ERANGE)
     return false;
+  *out = (uint64_t)v;
+  return true;
+}
+
+static void discover_rapl(void) {
+  if (!powercap_root[0])
+    sysfs_path(powercap_root, sizeof powercap_root, "/class/powercap");
+  DIR *dir = opendir(powercap_root);
+  if (!dir)
+    return;
+  struct dirent *ent;
+  while ((ent = readdir(dir)) != NULL && rapl_count < RAPL_DOMAINS_MAX) {
+    // the MMIO interface mirrors the package counter; skip it
+    if (ent->d_name[0] == '.' || strstr(ent->d_name, "mmio"))
+      continue;
+    char path[PATH_MAX];
+    char name[32];
+    snprintf(path, sizeof path, "%s/%s/name", powercap_root, ent->d_name);
+    if (!read_line_from_file(path, name, sizeof name))
+      continue;
+    RaplKind kind;
+    if (strncmp(name, "package", 7) == 0)
+      kind = RAPL_PACKAGE;
+    else if (strcmp(name, "core") == 0)
+      kind = RAPL_CORE;
+    else if (strcmp(name, "dram") == 0)
+      kind = RAPL_DRAM;
+    else
+      continue;
+    uint64_t range = 0;
+    snprintf(path, sizeof path, "%s/%s/max_energy_range_uj", powercap_root,
+             ent->d_name);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+      read_u64_fd(fd, &range);
+      close(fd);
+    }
+    snprintf(path, sizeof path, "%s/%s/energy_uj", powercap_root,
+             ent->d_name);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) // energy_uj is root-only on patched kernels
+      continue;
+    RaplDomain *d = &rapl[rapl_count++];
+    d->kind = kind;
+    d->fd = fd;
+    d->max_range_uj = range;
+    d->primed = false;
   }
-  if (raw > 1000.0)
-    raw /= 1000.0;
-  *out_c = raw;
+  closedir(dir);
+}
+
+static bool read_power(PowerInfo *info, const struct timespec *now) {
+  PowerInfo tmp = {0};
+  if (rapl_count == 0) {
+    *info = tmp;
+    return false;
+  }
+  double dt = (rapl_last_t.tv_sec || rapl_last_t.tv_nsec)
+                  ? (double)(now->tv_sec - rapl_last_t.tv_sec) +
+                        (double)(now->tv_nsec - rapl_last_t.tv_nsec) / 1e9
+                  : 0.0;
+  rapl_last_t = *now;
+  for (int i = 0; i < rapl_count; ++i) {
+    RaplDomain *d = &rapl[i];
+    uint64_t uj = 0;
+    if (!read_u64_fd(d->fd, &uj)) {
+      d->primed = false;
+      continue;
+    }
+    bool primed = d->primed;
+    uint64_t prev = d->last_uj;
+    d->last_uj = uj;
+    d->primed = true;
+    if (!primed || dt <= 0.0)
+      continue;
+    uint64_t delta;
+    if (uj >= prev)
+      delta = uj - prev;
+    else if (d->max_range_uj > prev)
+      delta = d->max_range_uj - prev + uj;
+    else
+      continue; // wrapped without a known range; skip one sample
+    tmp.watts[d->kind] += (double)delta / 1e6 / dt;
+    tmp.have[d->kind] = true;
+    if (d->kind == RAPL_PACKAGE)
+      rapl_package_j += (double)delta / 1e6;
+  }
+  if (tmp.have[RAPL_PACKAGE]) {
+    int slot = (rapl_window_head + rapl_window_len) % RAPL_WINDOW;
+    if (rapl_window_len == RAPL_WINDOW) {
+      slot = rapl_window_head;
+      rapl_window_head = (rapl_window_head + 1) % RAPL_WINDOW;
+    } else {
+      ++rapl_window_len;
+    }
+    rapl_window_j[slot] = rapl_package_j;
+    rapl_window_t[slot] = *now;
+    const struct timespec *t0 = &rapl_window_t[rapl_window_head];
+    double span = (double)(now->tv_sec - t0->tv_sec) +
+                  (double)(now->tv_nsec - t0->tv_nsec) / 1e9;
+    if (rapl_window_len > 1 && span > 0.0) {
+      tmp.package_avg =
+          (rapl_package_j - rapl_window_j[rapl_window_head]) / span;
+      tmp.have_avg = true;
+    }
+  }
+  *info = tmp;
+  return tmp.have[RAPL_PACKAGE] || tmp.have[RAPL_CORE] || tmp.have[RAPL_DRAM];
+}
+
+/* a gap in sampling (hidden window) must not be averaged over */
+static void reset_power_window(void) {
+  rapl_last_t = (struct timespec){0, 0};
+  rapl_window_len = 0;
+  rapl_window_head = 0;
+  for (int i = 0; i < rapl_count; ++i)
+    rapl[i].primed = false;
+}
+
+static bool power_info_equal(const PowerInfo *a, const PowerInfo *b) {
+  for (int k = 0; k < RAPL_KINDS; ++k) {
+    if (a->have[k] != b->have[k])
+      return false;
+    if (a->have[k] && double_abs(a->watts[k] - b->watts[k]) > 0.05)
+      return false;
+  }
+  if (a->have_avg != b->have_avg)
+    return false;
+  return !a->have_avg || double_abs(a->package_avg - b->package_avg) <= 0.05;
+}
+
+/* Top CPU consumers. /proc is scanned relative to a held dirfd with raw
+ * getdents64 into a reused buffer; per-pid CPU time from the previous scan
+ * lives in a hash table, and the next scan fills the other of two tables
+ * so exited pids disappear without tombstones. */
+#define TOP_MAX 16
+
+typedef struct {
+  pid_t pid; // 0 = empty slot
+  unsigned long long ticks;
+} PidTicks;
+
+typedef struct {
+  pid_t pid;
+  unsigned long long delta;
+  char comm[16];
+} TopCandidate;
+
+typedef struct {
+  char comm[16];
+  double cpu_pct; // of one CPU
+} TopEntry;
+
+static int top_n = 0;          // --top=N, 0 = panel unavailable
+static bool top_shown = false; // toggled with 't'
+static TopEntry top_entries[TOP_MAX];
+static int top_count = 0;
+
+static int proc_fd = -1;
+static PidTicks *pid_tables[2];
+static size_t pid_table_cap = 0; // power of two
+static int pid_table_cur = 0;
+static TopCandidate *top_cands = NULL;
+static size_t top_cands_cap = 0;
+static struct timespec top_last_t;
+
+struct linux_dirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+static PidTicks *pid_slot(PidTicks *table, pid_t pid) {
+  size_t mask = pid_table_cap - 1;
+  size_t i = ((size_t)pid * 2654435761u) & mask;
+  while (table[i].pid != 0 && table[i].pid != pid)
+    i = (i + 1) & mask;
+  return &table[i];
+}
+
+static bool pid_tables_reserve(size_t count) {
+  if (count * 2 <= pid_table_cap)
+    return true;
+  size_t cap = pid_table_cap ? pid_table_cap : 1024;
+  while (count * 2 > cap)
+    cap *= 2;
+  PidTicks *a = calloc(cap, sizeof *a);
+  PidTicks *b = calloc(cap, sizeof *b);
+  if (!a || !b) {
+    free(a);
+    free(b);
+    return false;
+  }
+  // rehash the previous scan so its deltas survive the resize
+  size_t old_cap = pid_table_cap;
+  PidTicks *old = pid_tables[pid_table_cur];
+  pid_table_cap = cap;
+  for (size_t i = 0; i < old_cap; ++i) {
+    if (old[i].pid != 0)
+      *pid_slot(a, old[i].pid) = old[i];
+  }
+  free(pid_tables[0]);
+  free(pid_tables[1]);
+  pid_tables[pid_table_cur] = a;
+  pid_tables[!pid_table_cur] = b;
   return true;
 }
 
-static bool detect_fan_speed_path(char *out, size_t n) {
-  if (!out || n == 0)
+/* comm and utime+stime from /proc/<pid>/stat */
+static bool parse_proc_stat(char *buf, char comm[16],
+                            unsigned long long *ticks) {
+  char *open_paren = strchr(buf, '(');
+  char *close_paren = strrchr(buf, ')');
+  if (!open_paren || !close_paren || close_paren < open_paren)
     return false;
-  const char *base = "/sys/class/hwmon";
-  DIR *dir = opendir(base);
-  if (dir) {
-    struct dirent *ent;
-    while ((ent = readdir(dir)) != NULL) {
-      if (strncmp(ent->d_name, "hwmon", 5) != 0)
+  size_t len = (size_t)(close_paren - open_paren - 1);
+  if (len > 15)
+    len = 15;
+  memcpy(comm, open_paren + 1, len);
+  comm[len] = '\0';
+  // fields after the comm start at 3 (state); utime and stime are 14, 15
+  char *p = close_paren + 2;
+  for (int field = 3; field < 14; ++field) {
+    p = strchr(p, ' ');
+    if (!p)
+      return false;
+    ++p;
+  }
+  char *end = NULL;
+  unsigned long long utime = strtoull(p, &end, 10);
+  if (end == p)
+    return false;
+  unsigned long long stime = strtoull(end, NULL, 10);
+  *ticks = utime + stime;
+  return true;
+}
+
+/* partial selection: afterwards c[0..k) holds the k largest deltas */
+static void select_top(TopCandidate *c, size_t n, size_t k) {
+  size_t lo = 0, hi = n; // the k-th element lies in [lo, hi)
+  while (hi - lo > 1) {
+    unsigned long long pivot = c[lo + (hi - lo) / 2].delta;
+    size_t i = lo, j = hi;
+    // three-way partition: [lo,i) > pivot, [i,m) == pivot, [j,hi) < pivot
+    size_t m = lo;
+    while (m < j) {
+      if (c[m].delta > pivot) {
+        TopCandidate t = c[m];
+        c[m++] = c[i];
+        c[i++] = t;
+      } else if (c[m].delta < pivot) {
+        TopCandidate t = c[m];
+        c[m] = c[--j];
+        c[j] = t;
+      } else {
+        ++m;
+      }
+    }
+    if (k <= i)
+      hi = i;
+    else if (k > j)
+      lo = j;
+    else
+      return;
+  }
+}
+
+static void sample_top(const struct timespec *now) {
+  if (proc_fd < 0)
+    proc_fd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (proc_fd < 0)
+    return;
+  double dt = (top_last_t.tv_sec || top_last_t.tv_nsec)
+                  ? (double)elapsed_ms(&top_last_t, now) / 1000.0
+                  : 0.0;
+  top_last_t = *now;
+  static long hz = 0;
+  if (!hz)
+    hz = sysconf(_SC_CLK_TCK);
+
+  if (!pid_tables_reserve(pid_table_cap ? pid_table_cap / 2 : 1))
+    return;
+  PidTicks *prev = pid_tables[pid_table_cur];
+  PidTicks *next = pid_tables[!pid_table_cur];
+  memset(next, 0, pid_table_cap * sizeof *next);
+
+  size_t ncands = 0;
+  size_t nprocs = 0;
+  static char dents[32768];
+  static char stat_buf[1024];
+  lseek(proc_fd, 0, SEEK_SET);
+  for (;;) {
+    long n = syscall(SYS_getdents64, proc_fd, dents, sizeof dents);
+    if (n <= 0)
+      break;
+    for (long off = 0; off < n;) {
+      struct linux_dirent64 *de = (struct linux_dirent64 *)(dents + off);
+      off += de->d_reclen;
+      if (de->d_name[0] < '1' || de->d_name[0] > '9')
         continue;
-      char hwmon_path[PATH_MAX];
-      snprintf(hwmon_path, sizeof hwmon_path, "%s/%s", base, ent->d_name);
-      for (int fan = 1; fan <= 8; ++fan) {
-        char candidate[PATH_MAX];
-        snprintf(candidate, sizeof candidate, "%s/fan%d_input", hwmon_path,
-                 fan);
-        FILE *f = fopen(candidate, "r");
-        if (f) {
-          fclose(f);
-          snprintf(out, n, "%s", candidate);
-          closedir(dir);
-          return true;
-        }
+      pid_t pid = (pid_t)strtol(de->d_name, NULL, 10);
+      char rel[32];
+      snprintf(rel, sizeof rel, "%s/stat", de->d_name);
+      int fd = openat(proc_fd, rel, O_RDONLY | O_CLOEXEC);
+      if (fd < 0)
+        continue; // exited meanwhile
+      ssize_t len = read(fd, stat_buf, sizeof stat_buf - 1);
+      close(fd);
+      if (len <= 0)
+        continue;
+      stat_buf[len] = '\0';
+      char comm[16];
+      unsigned long long ticks = 0;
+      if (!parse_proc_stat(stat_buf, comm, &ticks))
+        continue;
+      // the table is sized from the previous scan; skip the rest rather
+      // than overfill it if the process count jumped
+      if (++nprocs * 2 > pid_table_cap)
+        continue;
+      PidTicks *slot = pid_slot(next, pid);
+      slot->pid = pid;
+      slot->ticks = ticks;
+      PidTicks *old = pid_slot(prev, pid);
+      if (old->pid != pid || ticks <= old->ticks)
+        continue;
+      if (ncands == top_cands_cap) {
+        size_t cap = top_cands_cap ? top_cands_cap * 2 : 256;
+        TopCandidate *grown = realloc(top_cands, cap * sizeof *grown);
+        if (!grown)
+          continue;
+        top_cands = grown;
+        top_cands_cap = cap;
       }
+      TopCandidate *c = &top_cands[ncands++];
+      c->pid = pid;
+      c->delta = ticks - old->ticks;
+      memcpy(c->comm, comm, sizeof c->comm);
     }
-    closedir(dir);
   }
-  const char *fallbacks[] = {
-      "/sys/devices/platform/applesmc.768/fan1_input",
-      "/sys/devices/platform/thinkpad_hwmon/hwmon/hwmon0/fan1_input",
-      NULL};
-  for (size_t i = 0; fallbacks[i]; ++i) {
-    FILE *f = fopen(fallbacks[i], "r");
-    if (f) {
-      fclose(f);
-      snprintf(out, n, "%s", fallbacks[i]);
-      return true;
+  pid_table_cur = !pid_table_cur;
+  // grow before the next scan if this one came close to the limit
+  pid_tables_reserve(nprocs + nprocs / 4);
+
+  top_count = 0;
+  if (dt <= 0.0 || hz <= 0)
+    return;
+  size_t k = (size_t)top_n < ncands ? (size_t)top_n : ncands;
+  if (k < ncands)
+    select_top(top_cands, ncands, k);
+  for (size_t i = 1; i < k; ++i) { // order the few winners
+    TopCandidate t = top_cands[i];
+    size_t j = i;
+    while (j > 0 && top_cands[j - 1].delta < t.delta) {
+      top_cands[j] = top_cands[j - 1];
+      --j;
     }
+    top_cands[j] = t;
+  }
+  for (size_t i = 0; i < k; ++i) {
+    TopEntry *e = &top_entries[top_count++];
+    memcpy(e->comm, top_cands[i].comm, sizeof e->comm);
+    e->cpu_pct = (double)top_cands[i].delta * 100.0 / ((double)hz * dt);
   }
-  out[0] = '\0';
-  return false;
 }
 
-static bool read_fan_speed(double *out_rpm) {
-  if (!out_rpm)
-    return false;
-  if (!fan_speed_path[0])
-    detect_fan_speed_path(fan_speed_path, sizeof fan_speed_path);
-  if (!fan_speed_path[0])
+/* forget the previous scan, e.g. after the panel was hidden */
+static void reset_top(void) {
+  if (pid_table_cap)
+    memset(pid_tables[pid_table_cur], 0,
+           pid_table_cap * sizeof *pid_tables[0]);
+  top_last_t = (struct timespec){0, 0};
+  top_count = 0;
+}
+
+/* Pressure stall information. Each resource gets a kernel trigger; the fd
+ * becomes POLLPRI when "some" stall time exceeds the threshold within the
+ * window, and costs nothing otherwise. */
+typedef enum { PSI_CPU, PSI_MEMORY, PSI_IO, PSI_COUNT } PsiResource;
+
+typedef struct {
+  int fd;       // trigger fd, -1 if PSI is unavailable
+  double avg10; // "some" avg10 at the last read, percent
+  bool valid;
+} PsiSource;
+
+// 150 ms of stall within 1 s; unprivileged triggers need a 2 s window
+#define PSI_TRIGGER "some 150000 1000000"
+#define PSI_TRIGGER_UNPRIV "some 300000 2000000"
+// below this avg10 the pressure is considered settled
+#define PSI_QUIET_PCT 1.0
+// memory stalls lasting this long raise a notification (--psi-notify)
+#define PSI_SUSTAINED_MS 10000
+#define PSI_NOTIFY_COOLDOWN_MS 60000
+// events keep firing once per window while a stall persists; a longer gap
+// than this ends the episode
+#define PSI_EPISODE_GAP_MS 4000
+
+static PsiSource psi[PSI_COUNT] = {{.fd = -1}, {.fd = -1}, {.fd = -1}};
+static bool psi_notify_enabled = false;
+
+static int open_psi_trigger(const char *path) {
+  int fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  if (write(fd, PSI_TRIGGER, sizeof PSI_TRIGGER) < 0 &&
+      write(fd, PSI_TRIGGER_UNPRIV, sizeof PSI_TRIGGER_UNPRIV) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static void open_psi(void) {
+  const char *paths[PSI_COUNT] = {"/proc/pressure/cpu",
+                                  "/proc/pressure/memory",
+                                  "/proc/pressure/io"};
+  for (int i = 0; i < PSI_COUNT; ++i)
+    psi[i].fd = open_psi_trigger(paths[i]);
+}
+
+static bool read_psi(PsiSource *src) {
+  if (src->fd < 0)
     return false;
-  double raw = 0.0;
-  if (!read_double_from_file(fan_speed_path, &raw)) {
-    fan_speed_path[0] = '\0';
+  char buf[256];
+  ssize_t n = pread(src->fd, buf, sizeof buf - 1, 0);
+  if (n <= 0) {
+    src->valid = false;
     return false;
   }
-  if (raw < 0.0)
+  buf[n] = '\0';
+  double avg10 = 0.0;
+  if (sscanf(buf, "some avg10=%lf", &avg10) != 1) {
+    src->valid = false;
     return false;
-  *out_rpm = raw;
+  }
+  src->avg10 = avg10;
+  src->valid = true;
   return true;
 }
 
+static bool psi_elevated(void) {
+  for (int i = 0; i < PSI_COUNT; ++i) {
+    if (psi[i].valid && psi[i].avg10 >= PSI_QUIET_PCT)
+      return true;
+  }
+  return false;
+}
+
+/* called for every memory trigger event */
+static void psi_memory_stalled(const struct timespec *now) {
+  static struct timespec first = {0, 0};
+  static struct timespec last = {0, 0};
+  static struct timespec notified = {0, 0};
+  if (first.tv_sec == 0 || elapsed_ms(&last, now) > PSI_EPISODE_GAP_MS)
+    first = *now;
+  last = *now;
+  if (!psi_notify_enabled || elapsed_ms(&first, now) < PSI_SUSTAINED_MS)
+    return;
+  if (notified.tv_sec != 0 &&
+      elapsed_ms(&notified, now) < PSI_NOTIFY_COOLDOWN_MS)
+    return;
+  char msg[128];
+  snprintf(msg, sizeof msg, "Memory pressure: %.0f%% stalled",
+           psi[PSI_MEMORY].avg10);
+  send_notification(msg, NOTIF_CRITICAL);
+  notified = *now;
+}
+
 static bool detect_brightness_paths(void) {
   if (brightness_path[0] && max_brightness_path[0])
     return true;
-  DIR *dir = opendir("/sys/class/backlight");
+  char root[PATH_MAX];
+  sysfs_path(root, sizeof root, "/class/backlight");
+  DIR *dir = opendir(root);
   if (!dir)
     return false;
   struct dirent *ent;
@@ -436,7 +1602,7 @@ static bool detect_brightness_paths(void) {
     if (ent->d_name[0] == '.')
       continue;
     char base[PATH_MAX];
-    snprintf(base, sizeof base, "/sys/class/backlight/%s", ent->d_name);
+    snprintf(base, sizeof base, "%s/%s", root, ent->d_name);
     char b_path[PATH_MAX];
     char max_path[PATH_MAX];
     snprintf(b_path, sizeof b_path, "%s/brightness", base);
@@ -461,7 +1627,7 @@ static bool detect_brightness_paths(void) {
   return false;
 }
 
-static bool read_brightness(BrightnessInfo *info) {
+static bool read_brightness_sysfs(BrightnessInfo *info) {
   if (!info)
     return false;
   BrightnessInfo tmp = {0};
@@ -485,6 +1651,13 @@ static bool read_brightness(BrightnessInfo *info) {
   return true;
 }
 
+static bool read_brightness(BrightnessInfo *info) {
+  uint64_t t0 = stat_now();
+  bool ok = read_brightness_sysfs(info);
+  stat_record(STAT_READ_BRIGHTNESS, t0);
+  return ok;
+}
+
 static bool write_brightness(int value) {
   if (!detect_brightness_paths())
     return false;
@@ -519,6 +1692,7 @@ static bool get_backlight_name(char *out, size_t n) {
 }
 
 static bool set_brightness_via_service(DBusConnection *conn, int value);
+static DBusMessage *new_set_brightness_call(int value);
 static bool dbus_check(DBusError *err, const char *ctx);
 static bool set_governor_all(DBusConnection *conn, const char *governor);
 static void query_governor_info(GovernorInfo *info);
@@ -544,8 +1718,8 @@ static bool read_cpu_governor(int cpu, char *out, size_t n) {
     return false;
   }
   char path[PATH_MAX];
-  snprintf(path, sizeof path,
-           "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor", cpu);
+  sysfs_path(path, sizeof path,
+             "/devices/system/cpu/cpu%d/cpufreq/scaling_governor", cpu);
   FILE *f = fopen(path, "r");
   if (!f)
     return false;
@@ -562,22 +1736,29 @@ static bool read_cpu_governor(int cpu, char *out, size_t n) {
   return true;
 }
 
-static bool set_governor_via_service(DBusConnection *conn, int cpu,
-                                     const char *governor) {
-  if (!conn || !governor)
-    return false;
+static DBusMessage *new_set_governor_call(int cpu, const char *governor) {
   DBusMessage *msg = dbus_message_new_method_call(
       BRIGHTD_BUS, BRIGHTD_PATH, BRIGHTD_IFACE, "SetGovernor");
   if (!msg)
-    return false;
+    return NULL;
   int32_t cpu_arg = (int32_t)cpu;
   const char *gov_arg = governor;
   dbus_message_append_args(msg, DBUS_TYPE_INT32, &cpu_arg, DBUS_TYPE_STRING,
                            &gov_arg, DBUS_TYPE_INVALID);
+  return msg;
+}
+
+static bool set_governor_via_service(DBusConnection *conn, int cpu,
+                                     const char *governor) {
+  if (!conn || !governor)
+    return false;
+  DBusMessage *msg = new_set_governor_call(cpu, governor);
+  if (!msg)
+    return false;
   DBusError err;
   dbus_error_init(&err);
   DBusMessage *reply =
-      dbus_connection_send_with_reply_and_block(conn, msg, 2000, &err);
+      dbus_call_blocking(conn, msg, 2000, &err);
   dbus_message_unref(msg);
   if (!dbus_check(&err, "K16BrightD.SetGovernor")) {
     if (reply)
@@ -605,7 +1786,7 @@ static int detect_cpu_count(void) {
   struct stat st;
   char path[PATH_MAX];
   for (int cpu = 0; cpu < 4096; ++cpu) {
-    snprintf(path, sizeof path, "/sys/devices/system/cpu/cpu%d", cpu);
+    sysfs_path(path, sizeof path, "/devices/system/cpu/cpu%d", cpu);
     if (stat(path, &st) == 0 && S_ISDIR(st.st_mode))
       highest = cpu;
   }
@@ -625,123 +1806,483 @@ static bool ensure_governor_states(void) {
   return true;
 }
 
-static bool apply_powersave(DBusConnection *conn) {
-  if (!conn)
+static bool set_governor_all(DBusConnection *conn, const char *governor) {
+  if (!conn || !governor)
     return false;
   if (!ensure_governor_states())
     return false;
-  bool touched = false;
+  bool any = false;
   bool ok = true;
   for (int cpu = 0; cpu < governor_states_count; ++cpu) {
     char current[64];
     if (!read_cpu_governor(cpu, current, sizeof current))
       continue;
-    touched = true;
-    snprintf(governor_states[cpu].original,
-             sizeof governor_states[cpu].original, "%s", current);
-    governor_states[cpu].has_original = true;
-    if (strcmp(current, "powersave") != 0) {
-      if (!set_governor_via_service(conn, cpu, "powersave"))
-        ok = false;
-    }
-  }
-  if (touched) {
-    powersave_active = true;
-    if (!ok)
-      fprintf(stderr, "Warning: failed to set powersave governor on all CPUs\n");
-    return true;
+    any = true;
+    if (strcmp(current, governor) == 0) {
+      if (!powersave_active) {
+        snprintf(governor_states[cpu].original,
+                 sizeof governor_states[cpu].original, "%s", governor);
+        governor_states[cpu].has_original = true;
+      }
+      continue;
+    }
+    if (!set_governor_via_service(conn, cpu, governor)) {
+      ok = false;
+    } else if (!powersave_active) {
+      snprintf(governor_states[cpu].original,
+               sizeof governor_states[cpu].original, "%s", governor);
+      governor_states[cpu].has_original = true;
+    }
+  }
+  if (!any)
+    return false;
+  if (!ok)
+    fprintf(stderr, "Warning: failed to set governor on all CPUs\n");
+  GovernorInfo updated = {0};
+  query_governor_info(&updated);
+  if (updated.valid)
+    governor_info = updated;
+  return ok;
+}
+
+/* Power policy. Rules come from --policy=FILE, one per line:
+ *
+ *   on battery and percentage < 30 -> governor powersave, brightness <= 40%
+ *   temperature > 90 ~5 -> governor powersave
+ *
+ * Conditions are "on battery", "on ac" or "<input> <op> <value> [~band]"
+ * with inputs percentage, temperature (C) and rate (W), joined by "and".
+ * Actions are "governor NAME" and "brightness <= PCT". A numeric condition
+ * turns on at its threshold and only turns off again once the value has
+ * moved `band` past it (default per input), so readings that hover around
+ * a threshold do not flap.
+ *
+ * The first active rule with a governor wins; brightness caps combine to
+ * the lowest. Rules are compiled into flat condition/rule tables with a
+ * bitmask of the inputs each one reads, so an update only re-tests the
+ * conditions on inputs that changed and only re-applies an outcome that
+ * differs from the one already in effect. */
+#define POLICY_RULES_MAX 16
+#define POLICY_CONDS_MAX 64
+
+typedef enum {
+  PIN_ON_BATTERY,
+  PIN_PERCENTAGE,
+  PIN_TEMPERATURE,
+  PIN_RATE,
+  PIN_COUNT
+} PolicyInput;
+
+typedef enum { POP_LT, POP_LE, POP_GT, POP_GE, POP_TRUE, POP_FALSE } PolicyOp;
+
+typedef struct {
+  PolicyInput input;
+  PolicyOp op;
+  double threshold;
+  double band;
+  bool latched; // current (hysteretic) truth value
+} PolicyCond;
+
+typedef struct {
+  int first_cond, n_conds;
+  uint32_t deps; // bit per PolicyInput
+  char governor[32]; // empty = no opinion
+  int brightness_max; // percent, -1 = no opinion
+  bool active;
+} PolicyRule;
+
+typedef struct {
+  double v[PIN_COUNT];
+  bool have[PIN_COUNT];
+} PolicyInputs;
+
+static const char *const policy_input_names[PIN_COUNT] = {
+    "battery", "percentage", "temperature", "rate"};
+static const double policy_default_band[PIN_COUNT] = {0.0, 2.0, 5.0, 1.0};
+
+static struct {
+  PolicyCond conds[POLICY_CONDS_MAX];
+  int n_conds;
+  PolicyRule rules[POLICY_RULES_MAX];
+  int n_rules;
+  uint32_t deps; // union over all rules
+  PolicyInputs last;
+  bool primed;
+  char applied_governor[32];
+  int applied_brightness_max;
+  int saved_level;   // level before our cap, -1 if none
+  int written_level; // level our cap wrote
+} policy = {.applied_brightness_max = -1, .saved_level = -1};
+
+static int policy_input_lookup(const char *name) {
+  if (strcmp(name, "charge") == 0)
+    return PIN_PERCENTAGE;
+  if (strcmp(name, "temp") == 0)
+    return PIN_TEMPERATURE;
+  for (int i = PIN_PERCENTAGE; i < PIN_COUNT; ++i) {
+    if (strcmp(name, policy_input_names[i]) == 0)
+      return i;
+  }
+  return -1;
+}
+
+/* number with an optional unit suffix (%, C, W) */
+static bool policy_number(const char *tok, double *out) {
+  char *end = NULL;
+  errno = 0;
+  double v = strtod(tok, &end);
+  if (end == tok || errno != 0)
+    return false;
+  if (*end && strcmp(end, "%") != 0 && strcmp(end, "C") != 0 &&
+      strcmp(end, "W") != 0 && strcmp(end, "\xc2\xb0" "C") != 0)
+    return false;
+  *out = v;
+  return true;
+}
+
+/* compile one rule; returns false with a message in `why` on error */
+static bool policy_add_rule(const char *text, char *why, size_t why_n) {
+  char line[512];
+  snprintf(line, sizeof line, "%s", text);
+  char *arrow = strstr(line, "->");
+  if (!arrow) {
+    snprintf(why, why_n, "missing '->'");
+    return false;
+  }
+  *arrow = '\0';
+  if (policy.n_rules >= POLICY_RULES_MAX) {
+    snprintf(why, why_n, "too many rules");
+    return false;
+  }
+  PolicyRule r = {.first_cond = policy.n_conds, .brightness_max = -1};
+
+  char *tok[64];
+  int n = 0;
+  char *save = NULL;
+  for (char *t = strtok_r(line, " \t", &save); t && n < 64;
+       t = strtok_r(NULL, " \t", &save))
+    tok[n++] = t;
+  for (int i = 0; i < n;) {
+    if (policy.n_conds + r.n_conds >= POLICY_CONDS_MAX) {
+      snprintf(why, why_n, "too many conditions");
+      return false;
+    }
+    PolicyCond c = {0};
+    if (strcmp(tok[i], "on") == 0 && i + 1 < n) {
+      c.input = PIN_ON_BATTERY;
+      if (strcmp(tok[i + 1], "battery") == 0)
+        c.op = POP_TRUE;
+      else if (strcmp(tok[i + 1], "ac") == 0)
+        c.op = POP_FALSE;
+      else {
+        snprintf(why, why_n, "expected 'on battery' or 'on ac'");
+        return false;
+      }
+      i += 2;
+    } else {
+      int input = policy_input_lookup(tok[i]);
+      if (input < 0 || i + 2 >= n) {
+        snprintf(why, why_n, "bad condition at '%s'", tok[i]);
+        return false;
+      }
+      c.input = (PolicyInput)input;
+      const char *op = tok[i + 1];
+      if (strcmp(op, "<") == 0)
+        c.op = POP_LT;
+      else if (strcmp(op, "<=") == 0)
+        c.op = POP_LE;
+      else if (strcmp(op, ">") == 0)
+        c.op = POP_GT;
+      else if (strcmp(op, ">=") == 0)
+        c.op = POP_GE;
+      else {
+        snprintf(why, why_n, "bad operator '%s'", op);
+        return false;
+      }
+      if (!policy_number(tok[i + 2], &c.threshold)) {
+        snprintf(why, why_n, "bad number '%s'", tok[i + 2]);
+        return false;
+      }
+      c.band = policy_default_band[input];
+      i += 3;
+      if (i < n && tok[i][0] == '~') {
+        if (!policy_number(tok[i] + 1, &c.band) || c.band < 0) {
+          snprintf(why, why_n, "bad band '%s'", tok[i]);
+          return false;
+        }
+        ++i;
+      }
+    }
+    policy.conds[policy.n_conds + r.n_conds++] = c;
+    r.deps |= 1u << c.input;
+    if (i < n) {
+      if (strcmp(tok[i], "and") != 0 || i + 1 == n) {
+        snprintf(why, why_n, "expected 'and' at '%s'", tok[i]);
+        return false;
+      }
+      ++i;
+    }
+  }
+  if (r.n_conds == 0) {
+    snprintf(why, why_n, "rule has no conditions");
+    return false;
+  }
+
+  save = NULL;
+  for (char *act = strtok_r(arrow + 2, ",", &save); act;
+       act = strtok_r(NULL, ",", &save)) {
+    char word[32], arg1[64], arg2[32];
+    int got = sscanf(act, "%31s %63s %31s", word, arg1, arg2);
+    double pct;
+    if (got == 2 && strcmp(word, "governor") == 0 &&
+        strlen(arg1) < sizeof r.governor) {
+      snprintf(r.governor, sizeof r.governor, "%s", arg1);
+    } else if (got == 3 && strcmp(word, "brightness") == 0 &&
+               strcmp(arg1, "<=") == 0 && policy_number(arg2, &pct) &&
+               pct >= 0.0 && pct <= 100.0) {
+      r.brightness_max = (int)(pct + 0.5);
+    } else {
+      snprintf(why, why_n, "bad action '%s'", act);
+      return false;
+    }
+  }
+  if (!r.governor[0] && r.brightness_max < 0) {
+    snprintf(why, why_n, "rule has no actions");
+    return false;
+  }
+  policy.n_conds += r.n_conds;
+  policy.rules[policy.n_rules++] = r;
+  policy.deps |= r.deps;
+  return true;
+}
+
+static bool policy_load(const char *path) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    return false;
+  }
+  char line[512];
+  int lineno = 0;
+  bool ok = true;
+  while (fgets(line, sizeof line, f)) {
+    ++lineno;
+    line[strcspn(line, "#\r\n")] = '\0';
+    trim_whitespace(line);
+    if (!line[0])
+      continue;
+    char why[128];
+    if (!policy_add_rule(line, why, sizeof why)) {
+      fprintf(stderr, "%s:%d: %s\n", path, lineno, why);
+      ok = false;
+    }
+  }
+  fclose(f);
+  return ok;
+}
+
+static bool policy_cond_eval(const PolicyCond *c, double v) {
+  switch (c->op) {
+  case POP_TRUE:
+    return v != 0.0;
+  case POP_FALSE:
+    return v == 0.0;
+  case POP_LT:
+    return v < c->threshold + (c->latched ? c->band : 0.0);
+  case POP_LE:
+    return v <= c->threshold + (c->latched ? c->band : 0.0);
+  case POP_GT:
+    return v > c->threshold - (c->latched ? c->band : 0.0);
+  case POP_GE:
+    return v >= c->threshold - (c->latched ? c->band : 0.0);
   }
   return false;
 }
 
-static bool restore_governors(DBusConnection *conn) {
-  if (!conn || !governor_states)
-    return false;
-  bool have_state = false;
-  bool touched = false;
-  bool ok = true;
-  for (int cpu = 0; cpu < governor_states_count; ++cpu) {
-    if (!governor_states[cpu].has_original)
-      continue;
-    have_state = true;
-    const char *target = governor_states[cpu].original;
-    if (!target[0])
+/* SetGovernor/SetBrightness calls are all sent before any reply is
+ * awaited, so applying an outcome costs one round trip to K16BrightD */
+typedef struct {
+  DBusPendingCall **pending;
+  int n, cap;
+} BrightdBatch;
+
+static void batch_send(DBusConnection *conn, BrightdBatch *batch,
+                       DBusMessage *msg) {
+  if (!msg)
+    return;
+  DBusPendingCall *pc = NULL;
+  if (batch->n < batch->cap &&
+      dbus_connection_send_with_reply(conn, msg, &pc, 2000) && pc)
+    batch->pending[batch->n++] = pc;
+  dbus_message_unref(msg);
+}
+
+static bool batch_wait(DBusConnection *conn, BrightdBatch *batch) {
+  dbus_connection_flush(conn);
+  bool ok = true;
+  for (int i = 0; i < batch->n; ++i) {
+    dbus_pending_call_block(batch->pending[i]);
+    DBusMessage *reply = dbus_pending_call_steal_reply(batch->pending[i]);
+    if (!reply || dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_ERROR) {
+      const char *err_name = reply ? dbus_message_get_error_name(reply) : NULL;
+      fprintf(stderr, "K16BrightD: %s\n", err_name ? err_name : "no reply");
+      ok = false;
+    }
+    if (reply)
+      dbus_message_unref(reply);
+    dbus_pending_call_unref(batch->pending[i]);
+  }
+  batch->n = 0;
+  return ok;
+}
+
+/* queue governor writes for every CPU not already on `target`; NULL
+ * restores the governors saved when the override began */
+static void batch_governors(BrightdBatch *batch, DBusConnection *conn,
+                            const char *target) {
+  for (int cpu = 0; cpu < governor_states_count; ++cpu) {
+    GovernorState *gs = &governor_states[cpu];
+    char current[64];
+    if (!read_cpu_governor(cpu, current, sizeof current))
+      continue;
+    if (target && !powersave_active) {
+      snprintf(gs->original, sizeof gs->original, "%s", current);
+      gs->has_original = true;
+    }
+    const char *want = target ? target
+                       : gs->has_original && gs->original[0] ? gs->original
+                                                             : NULL;
+    if (want && strcmp(current, want) != 0)
+      batch_send(conn, batch, new_set_governor_call(cpu, want));
+  }
+  powersave_active = target != NULL;
+}
+
+/* cap the backlight at `cap_pct`, or undo our own cap when it is -1 */
+static void batch_brightness(BrightdBatch *batch, DBusConnection *conn,
+                             int cap_pct) {
+  BrightnessInfo cur = {0};
+  if (!read_brightness(&cur) || !cur.valid)
+    return;
+  if (cap_pct >= 0) {
+    int cap = (int)((double)cur.max * cap_pct / 100.0 + 0.5);
+    if (cur.level <= cap)
+      return;
+    if (policy.saved_level < 0)
+      policy.saved_level = cur.level;
+    policy.written_level = cap;
+    batch_send(conn, batch, new_set_brightness_call(cap));
+  } else if (policy.saved_level >= 0) {
+    // a level the user picked since then stays
+    if (cur.level == policy.written_level)
+      batch_send(conn, batch, new_set_brightness_call(policy.saved_level));
+    policy.saved_level = -1;
+  }
+}
+
+/* apply the outcome of the active rules, touching only what differs from
+ * the outcome already in effect; returns true if anything was written */
+static bool policy_apply(DBusConnection *conn, bool shutdown) {
+  const char *governor = NULL;
+  int cap = -1;
+  for (int i = 0; i < policy.n_rules && !shutdown; ++i) {
+    const PolicyRule *r = &policy.rules[i];
+    if (!r->active)
       continue;
-    char current[64];
-    if (read_cpu_governor(cpu, current, sizeof current) &&
-        strcmp(current, target) == 0)
-      continue;
-    if (!set_governor_via_service(conn, cpu, target))
-      ok = false;
-    else
-      touched = true;
+    if (!governor && r->governor[0])
+      governor = r->governor;
+    if (r->brightness_max >= 0 && (cap < 0 || r->brightness_max < cap))
+      cap = r->brightness_max;
   }
-  if (!have_state) {
-    powersave_active = false;
+  const char *applied =
+      policy.applied_governor[0] ? policy.applied_governor : NULL;
+  bool gov_diff = (governor == NULL) != (applied == NULL) ||
+                  (governor && strcmp(governor, applied) != 0);
+  bool cap_diff = cap != policy.applied_brightness_max;
+  if (!gov_diff && !cap_diff)
     return false;
+  if (gov_diff && !ensure_governor_states())
+    gov_diff = false;
+
+  BrightdBatch batch = {.cap = governor_states_count + 1};
+  batch.pending = calloc((size_t)batch.cap, sizeof *batch.pending);
+  if (!batch.pending)
+    return false;
+  if (gov_diff) {
+    batch_governors(&batch, conn, governor);
+    snprintf(policy.applied_governor, sizeof policy.applied_governor, "%s",
+             governor ? governor : "");
   }
-  if (ok)
-    powersave_active = false;
-  else if (touched)
-    fprintf(stderr, "Warning: failed to restore all CPU governors\n");
-  return touched || ok;
+  if (cap_diff) {
+    batch_brightness(&batch, conn, cap);
+    policy.applied_brightness_max = cap;
+  }
+  if (!batch_wait(conn, &batch))
+    fprintf(stderr, "Warning: power policy only partially applied\n");
+  free(batch.pending);
+  return true;
 }
 
-static bool set_governor_all(DBusConnection *conn, const char *governor) {
-  if (!conn || !governor)
+static void policy_gather(PolicyInputs *in, const BatteryInfo *b,
+                          const CpuInfo *cpu) {
+  memset(in, 0, sizeof *in);
+  if (b && b->valid) {
+    in->have[PIN_ON_BATTERY] = in->have[PIN_PERCENTAGE] = true;
+    in->have[PIN_RATE] = true;
+    in->v[PIN_ON_BATTERY] = (b->state == 2 || b->state == 3 || b->state == 6);
+    in->v[PIN_PERCENTAGE] = b->percentage;
+    in->v[PIN_RATE] = b->energy_rate;
+  }
+  if (cpu && cpu->have_temp) {
+    in->have[PIN_TEMPERATURE] = true;
+    in->v[PIN_TEMPERATURE] = cpu->temperature_c;
+  }
+}
+
+/* re-evaluate the rules whose inputs changed; returns true if the policy
+ * wrote anything (the caller should refresh what it displays) */
+static bool policy_update(DBusConnection *conn, const BatteryInfo *b,
+                          const CpuInfo *cpu) {
+  if (policy.n_rules == 0)
     return false;
-  if (!ensure_governor_states())
+  PolicyInputs in;
+  policy_gather(&in, b, cpu);
+  uint32_t changed = 0;
+  for (int i = 0; i < PIN_COUNT; ++i) {
+    if (!policy.primed || in.have[i] != policy.last.have[i] ||
+        in.v[i] != policy.last.v[i])
+      changed |= 1u << i;
+  }
+  changed &= policy.deps;
+  policy.last = in;
+  policy.primed = true;
+  if (!changed)
     return false;
+
+  for (int i = 0; i < policy.n_conds; ++i) {
+    PolicyCond *c = &policy.conds[i];
+    if (changed & (1u << c->input))
+      c->latched = in.have[c->input] && policy_cond_eval(c, in.v[c->input]);
+  }
   bool any = false;
-  bool ok = true;
-  for (int cpu = 0; cpu < governor_states_count; ++cpu) {
-    char current[64];
-    if (!read_cpu_governor(cpu, current, sizeof current))
-      continue;
-    any = true;
-    if (strcmp(current, governor) == 0) {
-      if (!powersave_active) {
-        snprintf(governor_states[cpu].original,
-                 sizeof governor_states[cpu].original, "%s", governor);
-        governor_states[cpu].has_original = true;
-      }
+  for (int i = 0; i < policy.n_rules; ++i) {
+    PolicyRule *r = &policy.rules[i];
+    if (!(r->deps & changed))
       continue;
-    }
-    if (!set_governor_via_service(conn, cpu, governor)) {
-      ok = false;
-    } else if (!powersave_active) {
-      snprintf(governor_states[cpu].original,
-               sizeof governor_states[cpu].original, "%s", governor);
-      governor_states[cpu].has_original = true;
+    bool active = true;
+    for (int j = 0; j < r->n_conds && active; ++j)
+      active = policy.conds[r->first_cond + j].latched;
+    if (active != r->active) {
+      r->active = active;
+      any = true;
     }
   }
-  if (!any)
-    return false;
-  if (!ok)
-    fprintf(stderr, "Warning: failed to set governor on all CPUs\n");
-  GovernorInfo updated = {0};
-  query_governor_info(&updated);
-  if (updated.valid)
-    governor_info = updated;
-  return ok;
+  return any && policy_apply(conn, false);
 }
 
-static bool handle_powersave_threshold(DBusConnection *conn,
-                                       const BatteryInfo *b) {
-  if (!powersave_threshold_enabled || !b || !b->valid)
-    return false;
-  if (powersave_active) {
-    if (b->percentage > powersave_threshold) {
-      if (restore_governors(conn))
-        return true;
-    }
-    return false;
-  }
-  if (b->percentage <= powersave_threshold) {
-    if (apply_powersave(conn))
-      return true;
-  }
-  return false;
+/* does any rule read the CPU temperature? */
+static bool policy_needs_temperature(void) {
+  return policy.deps & (1u << PIN_TEMPERATURE);
 }
 
 static void query_governor_info(GovernorInfo *info) {
@@ -1098,6 +2639,7 @@ static bool brightness_equal(const BrightnessInfo *a,
 static bool read_cpu_info(CpuInfo *info) {
   if (!info)
     return false;
+  uint64_t t0 = stat_now();
   CpuInfo tmp = {0};
   double mhz = 0.0;
   if (read_cpu_frequency(&mhz)) {
@@ -1115,6 +2657,7 @@ static bool read_cpu_info(CpuInfo *info) {
     tmp.have_fan = true;
   }
   *info = tmp;
+  stat_record(STAT_READ_CPU, t0);
   return tmp.have_freq || tmp.have_temp || tmp.have_fan;
 }
 
@@ -1396,9 +2939,7 @@ static const char *state_str(uint32_t s) {
   }
 }
 
-static void fmt_eta(char *out, size_t n, uint32_t state, int64_t tte,
-                    int64_t ttf) {
-  int64_t sec = (state == 1) ? ttf : (state == 2) ? tte : -1;
+static void fmt_eta(char *out, size_t n, int64_t sec) {
   if (sec <= 0) {
     snprintf(out, n, "?");
     return;
@@ -1411,9 +2952,45 @@ static void fmt_eta(char *out, size_t n, uint32_t state, int64_t tte,
     snprintf(out, n, "%ldm", m);
 }
 
-static void ui_draw(Ui *ui, const BatteryInfo *b, const CpuInfo *cpu,
-                    const BrightnessInfo *brightness,
-                    const GovernorInfo *governor) {
+static void format_device_row(const UpDevice *d, char *out, size_t n) {
+  const char *kind = device_kind_str(d->kind);
+  if (d->kind == UP_KIND_BATTERY)
+    snprintf(out, n, "%s%s%s: %.0f%%, %s", kind, d->model[0] ? " " : "",
+             d->model, d->info.percentage, state_str(d->info.state));
+  else
+    snprintf(out, n, "%s: %.0f%%", d->model[0] ? d->model : kind,
+             d->info.percentage);
+}
+
+static void ui_draw_device_row(Ui *ui, UpDevice *d) {
+  char line[128];
+  format_device_row(d, line, sizeof line);
+  int y = ui->rows_y + d->row * ROW_H;
+  XftDrawStringUtf8(ui->xft_draw, &ui->xft_color_text, ui->xft_font, 8, y,
+                    (const FcChar8 *)line, (int)strlen(line));
+  d->changed = false;
+}
+
+/* repaint only the rows of devices that changed since the last draw */
+static void ui_draw_changed_rows(Ui *ui) {
+  for (int i = 0; i < UP_DEVICE_SLOTS; ++i) {
+    UpDevice *d = &up_devices.slots[i];
+    if (d->state != SLOT_USED || !d->changed || d->row < 0)
+      continue;
+    int top = ui->rows_y + d->row * ROW_H - ROW_H + 4;
+    // the background transform set by ui_draw maps window coordinates, so
+    // compositing the band at its own offset reproduces it exactly
+    XRenderComposite(ui->dpy, PictOpSrc, ui->bg_picture, None,
+                     ui->win_picture, 1, top, 0, 0, 1, top, ui->win_w - 2,
+                     ROW_H);
+    ui_draw_device_row(ui, d);
+  }
+}
+
+/* returns the height the content needs */
+static int ui_draw(Ui *ui, const BatteryInfo *b, const CpuInfo *cpu,
+                   const PowerInfo *power, const BrightnessInfo *brightness,
+                   const GovernorInfo *governor) {
   if (!ui->win_picture) {
     XRenderPictFormat *fmt =
         XRenderFindStandardFormat(ui->dpy, PictStandardARGB32);
@@ -1452,7 +3029,7 @@ static void ui_draw(Ui *ui, const BatteryInfo *b, const CpuInfo *cpu,
   }
   int y = 18;
   if (b && b->valid) {
-    fmt_eta(l_eta, sizeof l_eta, b->state, b->tte, b->ttf);
+    fmt_eta(l_eta, sizeof l_eta, b->eta);
     snprintf(l_status, sizeof l_status, "%s; %.1f%%", state_str(b->state),
              b->percentage);
     snprintf(l_power, sizeof l_power, "%s, %.2f W", l_eta, b->energy_rate);
@@ -1507,6 +3084,41 @@ static void ui_draw(Ui *ui, const BatteryInfo *b, const CpuInfo *cpu,
                       (const FcChar8 *)fan_line, (int)strlen(fan_line));
     y += 16;
   }
+  if (power && power->have[RAPL_PACKAGE]) {
+    char pw_line[96];
+    if (power->have_avg)
+      snprintf(pw_line, sizeof pw_line, "Package: %.1f W (avg %.1f W)",
+               power->watts[RAPL_PACKAGE], power->package_avg);
+    else
+      snprintf(pw_line, sizeof pw_line, "Package: %.1f W",
+               power->watts[RAPL_PACKAGE]);
+    XftDrawStringUtf8(ui->xft_draw, &ui->xft_color_text, ui->xft_font, 8, y,
+                      (const FcChar8 *)pw_line, (int)strlen(pw_line));
+    y += 16;
+  }
+  if (power && (power->have[RAPL_CORE] || power->have[RAPL_DRAM])) {
+    char pw_line[96];
+    int len = snprintf(pw_line, sizeof pw_line, "Core: ");
+    if (power->have[RAPL_CORE])
+      len += snprintf(pw_line + len, sizeof pw_line - (size_t)len, "%.1f W",
+                      power->watts[RAPL_CORE]);
+    else
+      len += snprintf(pw_line + len, sizeof pw_line - (size_t)len, "?");
+    if (power->have[RAPL_DRAM])
+      snprintf(pw_line + len, sizeof pw_line - (size_t)len, ", DRAM: %.1f W",
+               power->watts[RAPL_DRAM]);
+    XftDrawStringUtf8(ui->xft_draw, &ui->xft_color_text, ui->xft_font, 8, y,
+                      (const FcChar8 *)pw_line, (int)strlen(pw_line));
+    y += 16;
+  }
+  if (psi[PSI_CPU].valid || psi[PSI_MEMORY].valid || psi[PSI_IO].valid) {
+    char psi_line[96];
+    snprintf(psi_line, sizeof psi_line, "Stall: cpu %.1f%%, mem %.1f%%, io %.1f%%",
+             psi[PSI_CPU].avg10, psi[PSI_MEMORY].avg10, psi[PSI_IO].avg10);
+    XftDrawStringUtf8(ui->xft_draw, &ui->xft_color_text, ui->xft_font, 8, y,
+                      (const FcChar8 *)psi_line, (int)strlen(psi_line));
+    y += 16;
+  }
   bool edit_b = edit_state.active && edit_state.field == EDIT_FIELD_BRIGHTNESS;
   bool edit_g = edit_state.active && edit_state.field == EDIT_FIELD_GOVERNOR;
 
@@ -1544,6 +3156,74 @@ static void ui_draw(Ui *ui, const BatteryInfo *b, const CpuInfo *cpu,
                       y, (const FcChar8 *)value, (int)strlen(value));
   }
   y += 16;
+
+  // per-device rows, ordered by object path so they do not jump around
+  ui->rows_y = y;
+  UpDevice *rows[UP_DEVICES_MAX];
+  int nrows = 0;
+  for (int i = 0; i < UP_DEVICE_SLOTS; ++i) {
+    UpDevice *d = &up_devices.slots[i];
+    d->row = -1;
+    if (!device_has_row(d) || nrows >= UP_DEVICES_MAX)
+      continue;
+    int at = nrows++;
+    while (at > 0 && strcmp(rows[at - 1]->path, d->path) > 0) {
+      rows[at] = rows[at - 1];
+      --at;
+    }
+    rows[at] = d;
+  }
+  for (int i = 0; i < nrows; ++i) {
+    rows[i]->row = i;
+    ui_draw_device_row(ui, rows[i]);
+    y += ROW_H;
+  }
+
+  if (top_shown) {
+    const char *hdr = top_count ? "Top CPU:" : "Top CPU: sampling...";
+    XftDrawStringUtf8(ui->xft_draw, &ui->xft_color_text, ui->xft_font, 8, y,
+                      (const FcChar8 *)hdr, (int)strlen(hdr));
+    y += ROW_H;
+    for (int i = 0; i < top_count; ++i) {
+      char line[64];
+      snprintf(line, sizeof line, "%5.1f%%  %s", top_entries[i].cpu_pct,
+               top_entries[i].comm);
+      XftDrawStringUtf8(ui->xft_draw, &ui->xft_color_text, ui->xft_font, 14,
+                        y, (const FcChar8 *)line, (int)strlen(line));
+      y += ROW_H;
+    }
+  }
+
+  if (stats_shown) {
+    char line[128];
+    for (int i = 0; i < STAT_TIMERS; ++i) {
+      stat_format_timer((StatTimer)i, line, sizeof line);
+      XftDrawStringUtf8(ui->xft_draw, &ui->xft_color_text, ui->xft_font, 8, y,
+                        (const FcChar8 *)line, (int)strlen(line));
+      y += ROW_H;
+    }
+    snprintf(line, sizeof line, "loops %llu, wake x/dbus/timeout/other "
+             "%llu/%llu/%llu/%llu",
+             (unsigned long long)stat_counters[STAT_LOOPS],
+             (unsigned long long)stat_counters[STAT_WAKE_X],
+             (unsigned long long)stat_counters[STAT_WAKE_DBUS],
+             (unsigned long long)stat_counters[STAT_WAKE_TIMEOUT],
+             (unsigned long long)stat_counters[STAT_WAKE_OTHER]);
+    XftDrawStringUtf8(ui->xft_draw, &ui->xft_color_text, ui->xft_font, 8, y,
+                      (const FcChar8 *)line, (int)strlen(line));
+    y += ROW_H;
+    snprintf(line, sizeof line, "redraws %llu, skipped cpu/power/bl/gov "
+             "%llu/%llu/%llu/%llu",
+             (unsigned long long)stat_counters[STAT_REDRAWS],
+             (unsigned long long)stat_counters[STAT_SKIP_CPU],
+             (unsigned long long)stat_counters[STAT_SKIP_POWER],
+             (unsigned long long)stat_counters[STAT_SKIP_BRIGHTNESS],
+             (unsigned long long)stat_counters[STAT_SKIP_GOVERNOR]);
+    XftDrawStringUtf8(ui->xft_draw, &ui->xft_color_text, ui->xft_font, 8, y,
+                      (const FcChar8 *)line, (int)strlen(line));
+    y += ROW_H;
+  }
+  return y - ROW_H + 8;
 }
 
 /* select appropriate icon buffer/len for the current battery info */
@@ -1678,24 +3358,31 @@ static bool dbus_check(DBusError *err, const char *ctx) {
   return true;
 }
 
-static bool set_brightness_via_service(DBusConnection *conn, int value) {
-  if (!conn)
-    return false;
+static DBusMessage *new_set_brightness_call(int value) {
   char backlight[128];
   if (!get_backlight_name(backlight, sizeof backlight))
-    return false;
+    return NULL;
   DBusMessage *msg = dbus_message_new_method_call(BRIGHTD_BUS, BRIGHTD_PATH,
                                                   BRIGHTD_IFACE,
                                                   "SetBrightness");
   if (!msg)
-    return false;
+    return NULL;
   const char *name_arg = backlight;
   dbus_message_append_args(msg, DBUS_TYPE_STRING, &name_arg, DBUS_TYPE_INT32,
                            &value, DBUS_TYPE_INVALID);
+  return msg;
+}
+
+static bool set_brightness_via_service(DBusConnection *conn, int value) {
+  if (!conn)
+    return false;
+  DBusMessage *msg = new_set_brightness_call(value);
+  if (!msg)
+    return false;
   DBusError err;
   dbus_error_init(&err);
   DBusMessage *reply =
-      dbus_connection_send_with_reply_and_block(conn, msg, 2000, &err);
+      dbus_call_blocking(conn, msg, 2000, &err);
   dbus_message_unref(msg);
   if (!dbus_check(&err, "K16BrightD.SetBrightness")) {
     if (reply)
@@ -1724,7 +3411,7 @@ static bool get_display_device_path(DBusConnection *conn, char *out, size_t n) {
   DBusError err;
   dbus_error_init(&err);
   DBusMessage *reply =
-      dbus_connection_send_with_reply_and_block(conn, msg, -1, &err);
+      dbus_call_blocking(conn, msg, UPOWER_TIMEOUT_MS, &err);
   dbus_message_unref(msg);
   if (!dbus_check(&err, "GetDisplayDevice"))
     return false;
@@ -1743,6 +3430,177 @@ static bool get_display_device_path(DBusConnection *conn, char *out, size_t n) {
   return true;
 }
 
+/* Discharge/charge rate estimate. UPower's TimeToEmpty/TimeToFull stay 0
+ * for minutes after a state change and jump around afterwards, so the
+ * rate is tracked here with a scalar Kalman filter fed by two kinds of
+ * measurements: EnergyRate whenever UPower reports a new one, and the
+ * slope between successive distinct energy readings (UPower's Energy or
+ * sysfs energy_now). The first measurement after a state change seeds the
+ * filter, giving an ETA within one sample; later ones are weighed by
+ * their variance and anything beyond RATE_GATE sigma is dropped, unless
+ * RATE_REJECT_MAX such readings in a row say the load really changed. */
+#define RATE_Q 0.05         // process noise, W^2 per second
+#define RATE_GATE 3.0       // outlier gate, in standard deviations
+#define RATE_REJECT_MAX 3   // consecutive outliers that force a reseed
+#define RATE_MIN_W 0.1      // below this the ETA is meaningless
+#define ENERGY_QUANTUM_WH 0.01
+#define BATTERIES_MAX 4
+
+typedef struct {
+  uint32_t state; // battery state the estimate belongs to
+  bool have;      // x is meaningful
+  double x;       // rate, W (positive in either direction)
+  double p;       // variance of x
+  int rejects;
+  struct timespec t; // time of the last predict step
+  double anchor_wh;  // last distinct energy reading
+  struct timespec anchor_t;
+  bool have_anchor;
+} RateEstimator;
+
+static RateEstimator rate_est;
+static int battery_energy_fds[BATTERIES_MAX];
+static int battery_energy_count = 0;
+
+static void rate_reset(uint32_t state) {
+  memset(&rate_est, 0, sizeof rate_est);
+  rate_est.state = state;
+}
+
+static void rate_measure(double z, double r, const struct timespec *now) {
+  if (!rate_est.have) {
+    rate_est.x = z;
+    rate_est.p = r;
+    rate_est.have = true;
+    rate_est.rejects = 0;
+    rate_est.t = *now;
+    return;
+  }
+  double dt = (double)elapsed_ms(&rate_est.t, now) / 1000.0;
+  rate_est.p += RATE_Q * (dt > 0.0 ? dt : 0.0);
+  rate_est.t = *now;
+  double y = z - rate_est.x;
+  double s = rate_est.p + r;
+  if (y * y > RATE_GATE * RATE_GATE * s) {
+    if (++rate_est.rejects < RATE_REJECT_MAX)
+      return;
+    rate_est.x = z; // persistent disagreement: the load changed
+    rate_est.p = r;
+    rate_est.rejects = 0;
+    return;
+  }
+  rate_est.rejects = 0;
+  double k = rate_est.p / s;
+  rate_est.x += k * y;
+  rate_est.p *= 1.0 - k;
+}
+
+/* a new total energy reading (Wh) for the current state */
+static void rate_observe_energy(double wh, const struct timespec *now) {
+  if (wh <= 0.0)
+    return;
+  if (!rate_est.have_anchor) {
+    rate_est.anchor_wh = wh;
+    rate_est.anchor_t = *now;
+    rate_est.have_anchor = true;
+    return;
+  }
+  if (wh == rate_est.anchor_wh)
+    return; // gauges update in steps; only a change carries information
+  double dt = (double)elapsed_ms(&rate_est.anchor_t, now) / 1000.0;
+  double de = rate_est.state == 1 ? wh - rate_est.anchor_wh
+                                  : rate_est.anchor_wh - wh;
+  rate_est.anchor_wh = wh;
+  rate_est.anchor_t = *now;
+  if (dt < 1.0 || de <= 0.0)
+    return; // too close together, or the gauge moved the wrong way
+  double w = de * 3600.0 / dt;
+  double sigma = ENERGY_QUANTUM_WH * 3600.0 / dt;
+  rate_measure(w, 2.0 * sigma * sigma, now);
+}
+
+/* feed what changed between two snapshots of the display device */
+static void rate_observe(const BatteryInfo *before, const BatteryInfo *after) {
+  if (!after->valid)
+    return;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (after->state != rate_est.state)
+    rate_reset(after->state);
+  if (after->state != 1 && after->state != 2)
+    return;
+  if (after->energy_rate > 0.0 &&
+      (after->energy_rate != before->energy_rate ||
+       before->state != after->state || !rate_est.have)) {
+    double r = 0.25 + 0.0025 * after->energy_rate * after->energy_rate;
+    rate_measure(after->energy_rate, r, &now);
+  }
+  if (after->energy != before->energy)
+    rate_observe_energy(after->energy, &now);
+}
+
+static void discover_batteries(void) {
+  for (int i = 0; i < battery_energy_count; ++i)
+    close(battery_energy_fds[i]);
+  battery_energy_count = 0;
+  char root[PATH_MAX];
+  sysfs_path(root, sizeof root, "/class/power_supply");
+  DIR *dir = opendir(root);
+  if (!dir)
+    return;
+  struct dirent *de;
+  while ((de = readdir(dir)) && battery_energy_count < BATTERIES_MAX) {
+    if (de->d_name[0] == '.')
+      continue;
+    char path[PATH_MAX], type[32], scope[32];
+    snprintf(path, sizeof path, "%s/%s/type", root, de->d_name);
+    if (!read_line_from_file(path, type, sizeof type) ||
+        strcmp(type, "Battery") != 0)
+      continue;
+    // peripherals (mice, headsets) report scope=Device
+    snprintf(path, sizeof path, "%s/%s/scope", root, de->d_name);
+    if (read_line_from_file(path, scope, sizeof scope) &&
+        strcmp(scope, "Device") == 0)
+      continue;
+    snprintf(path, sizeof path, "%s/%s/energy_now", root, de->d_name);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0)
+      battery_energy_fds[battery_energy_count++] = fd;
+  }
+  closedir(dir);
+}
+
+/* sample energy_now of the system batteries (summed, like UPower does) */
+static void rate_sample_sysfs(const struct timespec *now) {
+  if (battery_energy_count == 0 ||
+      (rate_est.state != 1 && rate_est.state != 2))
+    return;
+  double wh = 0.0;
+  for (int i = 0; i < battery_energy_count; ++i) {
+    uint64_t uwh;
+    if (!read_u64_fd(battery_energy_fds[i], &uwh))
+      return;
+    wh += (double)uwh / 1e6;
+  }
+  rate_observe_energy(wh, now);
+}
+
+/* seconds to empty/full; the estimate when there is one, else UPower's */
+static int64_t battery_eta(const BatteryInfo *b) {
+  int64_t upower = b->state == 1 ? b->ttf : b->state == 2 ? b->tte : -1;
+  if (!b->valid || b->state != rate_est.state || !rate_est.have ||
+      rate_est.x < RATE_MIN_W)
+    return upower;
+  double energy = rate_est.have_anchor ? rate_est.anchor_wh : b->energy;
+  double left = b->state == 1 ? b->energy_full - energy : energy;
+  if (energy <= 0.0 || left <= 0.0)
+    return upower;
+  double sec = left * 3600.0 / rate_est.x;
+  if (sec > 7.0 * 24 * 3600)
+    return upower;
+  return (int64_t)sec;
+}
+
 static void apply_kv(const char *key, int vtype, DBusMessageIter *var,
                      BatteryInfo *b) {
   if (strcmp(key, "Percentage") == 0 && vtype == DBUS_TYPE_DOUBLE) {
@@ -1755,6 +3613,10 @@ static void apply_kv(const char *key, int vtype, DBusMessageIter *var,
     dbus_message_iter_get_basic(var, &d);
     b->energy_rate = d;
     b->valid = true;
+  } else if (strcmp(key, "Energy") == 0 && vtype == DBUS_TYPE_DOUBLE) {
+    dbus_message_iter_get_basic(var, &b->energy);
+  } else if (strcmp(key, "EnergyFull") == 0 && vtype == DBUS_TYPE_DOUBLE) {
+    dbus_message_iter_get_basic(var, &b->energy_full);
   } else if (strcmp(key, "State") == 0 && vtype == DBUS_TYPE_UINT32) {
     uint32_t u;
     dbus_message_iter_get_basic(var, &u);
@@ -1785,70 +3647,310 @@ static void apply_kv(const char *key, int vtype, DBusMessageIter *var,
   }
 }
 
-static bool fetch_props(DBusConnection *conn, const char *dev_path,
-                        BatteryInfo *b) {
+static void apply_device_kv(UpDevice *d, const char *key, int vtype,
+                            DBusMessageIter *var, BatteryInfo *b) {
+  if (d && strcmp(key, "Type") == 0 && vtype == DBUS_TYPE_UINT32) {
+    dbus_message_iter_get_basic(var, &d->kind);
+  } else if (d && strcmp(key, "Model") == 0 && vtype == DBUS_TYPE_STRING) {
+    const char *model = NULL;
+    dbus_message_iter_get_basic(var, &model);
+    snprintf(d->model, sizeof d->model, "%s", model ? model : "");
+  } else {
+    apply_kv(key, vtype, var, b);
+  }
+}
+
+/* walk an a{sv} property dictionary; `d` may be NULL */
+static void apply_prop_dict(DBusMessageIter *arr, UpDevice *d,
+                            BatteryInfo *b) {
+  while (dbus_message_iter_get_arg_type(arr) == DBUS_TYPE_DICT_ENTRY) {
+    DBusMessageIter entry;
+    dbus_message_iter_recurse(arr, &entry);
+    const char *key = NULL;
+    if (dbus_message_iter_get_arg_type(&entry) != DBUS_TYPE_STRING) {
+      dbus_message_iter_next(arr);
+      continue;
+    }
+    dbus_message_iter_get_basic(&entry, &key);
+    dbus_message_iter_next(&entry);
+    if (dbus_message_iter_get_arg_type(&entry) != DBUS_TYPE_VARIANT) {
+      dbus_message_iter_next(arr);
+      continue;
+    }
+    DBusMessageIter var;
+    dbus_message_iter_recurse(&entry, &var);
+    int vtype = dbus_message_iter_get_arg_type(&var);
+    apply_device_kv(d, key, vtype, &var, b);
+    dbus_message_iter_next(arr);
+  }
+}
+
+static bool apply_props_reply(DBusMessage *reply, UpDevice *d,
+                              BatteryInfo *b) {
+  DBusMessageIter it;
+  if (!dbus_message_iter_init(reply, &it) ||
+      dbus_message_iter_get_arg_type(&it) != DBUS_TYPE_ARRAY)
+    return false;
+  DBusMessageIter arr;
+  dbus_message_iter_recurse(&it, &arr);
+  apply_prop_dict(&arr, d, b);
+  return b->valid;
+}
+
+static DBusMessage *new_getall_call(const char *dev_path) {
   DBusMessage *msg = dbus_message_new_method_call(UPOWER_BUS, dev_path,
                                                   DBUS_PROP_IF, "GetAll");
   if (!msg)
-    return false;
+    return NULL;
   const char *iface = UPOWER_DEV_IF;
   dbus_message_append_args(msg, DBUS_TYPE_STRING, &iface, DBUS_TYPE_INVALID);
+  return msg;
+}
+
+static bool fetch_props(DBusConnection *conn, const char *dev_path,
+                        BatteryInfo *b) {
+  DBusMessage *msg = new_getall_call(dev_path);
+  if (!msg)
+    return false;
 
+  uint64_t t0 = stat_now();
   DBusError err;
   dbus_error_init(&err);
   DBusMessage *reply =
-      dbus_connection_send_with_reply_and_block(conn, msg, -1, &err);
+      dbus_call_blocking(conn, msg, UPOWER_TIMEOUT_MS, &err);
   dbus_message_unref(msg);
-  if (!dbus_check(&err, "GetAll"))
-    return false;
-  if (!reply)
-    return false;
+  bool ok = false;
+  if (dbus_check(&err, "GetAll") && reply) {
+    ok = apply_props_reply(reply, NULL, b);
+    dbus_message_unref(reply);
+  }
+  stat_record(STAT_FETCH_PROPS, t0);
+  return ok;
+}
 
-  DBusMessageIter it;
-  if (!dbus_message_iter_init(reply, &it) ||
-      dbus_message_iter_get_arg_type(&it) != DBUS_TYPE_ARRAY) {
+#define INFLIGHT_MAX (UP_DEVICES_MAX + 4)
+
+struct SignalCtx;
+typedef void (*AsyncDone)(struct SignalCtx *ctx, DBusMessage *reply,
+                          const char *path);
+
+typedef struct {
+  DBusPendingCall *call;
+  struct timespec started;
+} InFlight;
+
+typedef struct SignalCtx {
+  DBusConnection *conn;
+  BatteryInfo *b;
+  const char *dev_path;
+  bool *dirty;      // full redraw
+  bool *rows_dirty; // only some device rows changed
+  // asynchronous calls; we never install timeout functions on the
+  // connection, so libdbus will not expire these by itself
+  InFlight inflight[INFLIGHT_MAX];
+  int n_inflight;
+} SignalCtx;
+
+typedef struct {
+  SignalCtx *ctx;
+  AsyncDone done;
+  char path[128];
+} AsyncCall;
+
+static void inflight_forget(SignalCtx *ctx, DBusPendingCall *call) {
+  for (int i = 0; i < ctx->n_inflight; ++i) {
+    if (ctx->inflight[i].call == call) {
+      ctx->inflight[i] = ctx->inflight[--ctx->n_inflight];
+      return;
+    }
+  }
+}
+
+static void async_notify(DBusPendingCall *pending, void *user) {
+  AsyncCall *ac = (AsyncCall *)user;
+  DBusMessage *reply = dbus_pending_call_steal_reply(pending);
+  inflight_forget(ac->ctx, pending);
+  if (reply) {
+    if (dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_ERROR) {
+      const char *err_name = dbus_message_get_error_name(reply);
+      fprintf(stderr, "%s: %s\n", ac->path, err_name ? err_name : "?");
+    } else {
+      ac->done(ac->ctx, reply, ac->path);
+    }
     dbus_message_unref(reply);
+  }
+  dbus_pending_call_unref(pending);
+}
+
+/* send `msg` (consumed) and call `done` with the reply from dispatch */
+static bool call_async(SignalCtx *ctx, DBusMessage *msg, const char *path,
+                       AsyncDone done) {
+  if (!msg)
+    return false;
+  if (ctx->n_inflight >= INFLIGHT_MAX) {
+    dbus_message_unref(msg);
     return false;
   }
-  DBusMessageIter arr;
-  dbus_message_iter_recurse(&it, &arr);
-  while (dbus_message_iter_get_arg_type(&arr) == DBUS_TYPE_DICT_ENTRY) {
-    DBusMessageIter entry;
-    dbus_message_iter_recurse(&arr, &entry);
-    const char *key = NULL;
-    if (dbus_message_iter_get_arg_type(&entry) != DBUS_TYPE_STRING) {
-      dbus_message_iter_next(&arr);
-      continue;
-    }
-    dbus_message_iter_get_basic(&entry, &key);
-    dbus_message_iter_next(&entry);
-    if (dbus_message_iter_get_arg_type(&entry) != DBUS_TYPE_VARIANT) {
-      dbus_message_iter_next(&arr);
+  AsyncCall *ac = calloc(1, sizeof *ac);
+  if (!ac) {
+    dbus_message_unref(msg);
+    return false;
+  }
+  ac->ctx = ctx;
+  ac->done = done;
+  snprintf(ac->path, sizeof ac->path, "%s", path);
+  DBusPendingCall *pending = NULL;
+  bool sent = dbus_connection_send_with_reply(ctx->conn, msg, &pending,
+                                              UPOWER_TIMEOUT_MS) &&
+              pending;
+  dbus_message_unref(msg);
+  if (!sent) {
+    free(ac);
+    return false;
+  }
+  if (!dbus_pending_call_set_notify(pending, async_notify, ac, free)) {
+    free(ac);
+    dbus_pending_call_cancel(pending);
+    dbus_pending_call_unref(pending);
+    return false;
+  }
+  InFlight *f = &ctx->inflight[ctx->n_inflight++];
+  f->call = pending;
+  clock_gettime(CLOCK_MONOTONIC, &f->started);
+  if (dbus_pending_call_get_completed(pending))
+    async_notify(pending, ac);
+  return true;
+}
+
+static void expire_inflight(SignalCtx *ctx, const struct timespec *now,
+                            int *timeout) {
+  for (int i = 0; i < ctx->n_inflight;) {
+    long left = UPOWER_TIMEOUT_MS - elapsed_ms(&ctx->inflight[i].started, now);
+    if (left > 0) {
+      timeout_min(timeout, left);
+      ++i;
       continue;
     }
-    DBusMessageIter var;
-    dbus_message_iter_recurse(&entry, &var);
-    int vtype = dbus_message_iter_get_arg_type(&var);
-    apply_kv(key, vtype, &var, b);
+    DBusPendingCall *call = ctx->inflight[i].call;
+    ctx->inflight[i] = ctx->inflight[--ctx->n_inflight];
+    fprintf(stderr, "UPower call timed out\n");
+    dbus_pending_call_cancel(call);
+    dbus_pending_call_unref(call);
+  }
+}
+
+static void display_props_done(SignalCtx *ctx, DBusMessage *reply,
+                               const char *path) {
+  (void)path;
+  BatteryInfo fresh = {0};
+  apply_props_reply(reply, NULL, &fresh);
+  bench_signal();
+  rate_observe(ctx->b, &fresh);
+  *ctx->b = fresh;
+  *ctx->dirty = true;
+}
+
+static void device_props_done(SignalCtx *ctx, DBusMessage *reply,
+                              const char *path) {
+  UpDevice *d = device_lookup(path);
+  if (!d) // removed while the call was in flight
+    return;
+  BatteryInfo fresh = {0};
+  apply_props_reply(reply, d, &fresh);
+  d->info = fresh;
+  d->changed = true;
+  // kind and model may have changed which rows exist
+  *ctx->dirty = true;
+}
+
+static void device_track(SignalCtx *ctx, const char *path) {
+  if (strcmp(path, ctx->dev_path) == 0)
+    return;
+  if (!device_insert(path)) {
+    fprintf(stderr, "Too many UPower devices, ignoring %s\n", path);
+    return;
+  }
+  call_async(ctx, new_getall_call(path), path, device_props_done);
+}
+
+static void enumerate_done(SignalCtx *ctx, DBusMessage *reply,
+                           const char *path) {
+  (void)path;
+  DBusMessageIter it, arr;
+  if (!dbus_message_iter_init(reply, &it) ||
+      dbus_message_iter_get_arg_type(&it) != DBUS_TYPE_ARRAY)
+    return;
+  dbus_message_iter_recurse(&it, &arr);
+  while (dbus_message_iter_get_arg_type(&arr) == DBUS_TYPE_OBJECT_PATH) {
+    const char *dev = NULL;
+    dbus_message_iter_get_basic(&arr, &dev);
+    device_track(ctx, dev);
     dbus_message_iter_next(&arr);
   }
-  dbus_message_unref(reply);
-  return b->valid;
+  *ctx->dirty = true;
+}
+
+/* (re)build the device table; replies arrive through dispatch */
+static void enumerate_devices(SignalCtx *ctx) {
+  device_clear_all();
+  UpDevice *display = device_insert(ctx->dev_path);
+  if (display)
+    display->is_display = true;
+  DBusMessage *msg = dbus_message_new_method_call(
+      UPOWER_BUS, UPOWER_PATH, UPOWER_IFACE, "EnumerateDevices");
+  call_async(ctx, msg, UPOWER_PATH, enumerate_done);
+}
+
+static DBusHandlerResult name_owner_changed(SignalCtx *ctx, DBusMessage *m) {
+  const char *name = NULL, *old_owner = NULL, *new_owner = NULL;
+  if (!dbus_message_get_args(m, NULL, DBUS_TYPE_STRING, &name,
+                             DBUS_TYPE_STRING, &old_owner, DBUS_TYPE_STRING,
+                             &new_owner, DBUS_TYPE_INVALID))
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+  if (strcmp(name, UPOWER_BUS) != 0)
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+  if (new_owner[0]) {
+    // (re)started: our cached state may be arbitrarily stale
+    call_async(ctx, new_getall_call(ctx->dev_path), ctx->dev_path,
+               display_props_done);
+    enumerate_devices(ctx);
+  } else {
+    BatteryInfo gone = {0};
+    *ctx->b = gone;
+    device_clear_all();
+    *(ctx->dirty) = true;
+  }
+  return DBUS_HANDLER_RESULT_HANDLED;
 }
 
-typedef struct {
-  BatteryInfo *b;
-  const char *dev_path;
-  bool *dirty;
-} SignalCtx;
+static DBusHandlerResult device_added_removed(SignalCtx *ctx, DBusMessage *m,
+                                              bool added) {
+  const char *path = NULL;
+  if (!dbus_message_get_args(m, NULL, DBUS_TYPE_OBJECT_PATH, &path,
+                             DBUS_TYPE_INVALID))
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+  if (added)
+    device_track(ctx, path);
+  else
+    device_remove(path);
+  *(ctx->dirty) = true;
+  return DBUS_HANDLER_RESULT_HANDLED;
+}
 
 static DBusHandlerResult signal_filter(DBusConnection *c, DBusMessage *m,
                                        void *user) {
   SignalCtx *ctx = (SignalCtx *)user;
+  if (dbus_message_is_signal(m, DBUS_INTERFACE_DBUS, "NameOwnerChanged"))
+    return name_owner_changed(ctx, m);
+  if (dbus_message_is_signal(m, UPOWER_IFACE, "DeviceAdded"))
+    return device_added_removed(ctx, m, true);
+  if (dbus_message_is_signal(m, UPOWER_IFACE, "DeviceRemoved"))
+    return device_added_removed(ctx, m, false);
   if (!dbus_message_is_signal(m, DBUS_PROP_IF, "PropertiesChanged"))
     return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
   const char *path = dbus_message_get_path(m);
-  if (!path || strcmp(path, ctx->dev_path) != 0)
+  UpDevice *d = path ? device_lookup(path) : NULL;
+  if (!d)
     return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 
   DBusMessageIter it;
@@ -1867,23 +3969,24 @@ static DBusHandlerResult signal_filter(DBusConnection *c, DBusMessage *m,
 
   DBusMessageIter changes;
   dbus_message_iter_recurse(&it, &changes);
-  while (dbus_message_iter_get_arg_type(&changes) == DBUS_TYPE_DICT_ENTRY) {
-    DBusMessageIter entry;
-    dbus_message_iter_recurse(&changes, &entry);
-    const char *key = NULL;
-    dbus_message_iter_get_basic(&entry, &key);
-    dbus_message_iter_next(&entry);
-    if (dbus_message_iter_get_arg_type(&entry) != DBUS_TYPE_VARIANT) {
-      dbus_message_iter_next(&changes);
-      continue;
-    }
-    DBusMessageIter var;
-    dbus_message_iter_recurse(&entry, &var);
-    int vtype = dbus_message_iter_get_arg_type(&var);
-    apply_kv(key, vtype, &var, ctx->b);
-    dbus_message_iter_next(&changes);
+  if (d->is_display) {
+    bench_signal();
+    BatteryInfo before = *ctx->b;
+    apply_prop_dict(&changes, NULL, ctx->b);
+    rate_observe(&before, ctx->b);
+    *(ctx->dirty) = true;
+  } else {
+    bool had_row = device_has_row(d);
+    uint32_t kind = d->kind;
+    apply_prop_dict(&changes, d, &d->info);
+    d->changed = true;
+    if (had_row || device_has_row(d))
+      bench_signal();
+    if (had_row != device_has_row(d) || kind != d->kind)
+      *(ctx->dirty) = true;
+    else
+      *(ctx->rows_dirty) = true;
   }
-  *(ctx->dirty) = true;
   return DBUS_HANDLER_RESULT_HANDLED;
 }
 
@@ -1983,7 +4086,14 @@ static bool ui_init(Ui *ui) {
   XStoreName(ui->dpy, ui->win, "x11power");
   XSelectInput(ui->dpy, ui->win,
                ExposureMask | KeyPressMask | StructureNotifyMask |
-                   ButtonPressMask | ButtonReleaseMask | PointerMotionMask);
+                   ButtonPressMask | ButtonReleaseMask | PointerMotionMask |
+                   VisibilityChangeMask | PropertyChangeMask);
+  ui->net_wm_state = XInternAtom(ui->dpy, "_NET_WM_STATE", False);
+  ui->net_wm_state_hidden =
+      XInternAtom(ui->dpy, "_NET_WM_STATE_HIDDEN", False);
+  ui->mapped = true;
+  ui->hidden = false;
+  ui->obscured = false;
   ui->gc = XCreateGC(ui->dpy, ui->win, 0, NULL);
   Atom wm_delete = XInternAtom(ui->dpy, "WM_DELETE_WINDOW", False);
   XSetWMProtocols(ui->dpy, ui->win, &wm_delete, 1);
@@ -2001,9 +4111,340 @@ static bool ui_init(Ui *ui) {
   return true;
 }
 
-static void send_notification(const char *msg) {
-  if (!msg)
+static bool ui_visible(const Ui *ui) {
+  return ui->mapped && !ui->hidden && !ui->obscured;
+}
+
+static bool ui_read_hidden_state(Ui *ui) {
+  Atom type;
+  int format;
+  unsigned long nitems, after;
+  unsigned char *data = NULL;
+  bool hidden = false;
+  if (XGetWindowProperty(ui->dpy, ui->win, ui->net_wm_state, 0, 64, False,
+                         XA_ATOM, &type, &format, &nitems, &after,
+                         &data) == Success &&
+      data) {
+    if (type == XA_ATOM && format == 32) {
+      Atom *atoms = (Atom *)data;
+      for (unsigned long i = 0; i < nitems; ++i) {
+        if (atoms[i] == ui->net_wm_state_hidden) {
+          hidden = true;
+          break;
+        }
+      }
+    }
+    XFree(data);
+  }
+  return hidden;
+}
+
+/* update visibility from an X event; returns true if the event was one of
+ * ours (map state, visibility or _NET_WM_STATE) */
+static bool ui_track_visibility(Ui *ui, const XEvent *e) {
+  switch (e->type) {
+  case MapNotify:
+    ui->mapped = true;
+    return true;
+  case UnmapNotify:
+    ui->mapped = false;
+    return true;
+  case VisibilityNotify:
+    ui->obscured = e->xvisibility.state == VisibilityFullyObscured;
+    return true;
+  case PropertyNotify:
+    if (e->xproperty.atom != ui->net_wm_state)
+      return false;
+    ui->hidden = ui_read_hidden_state(ui);
+    return true;
+  default:
+    return false;
+  }
+}
+
+static void dbus_drain(DBusConnection *conn) {
+  dbus_connection_read_write(conn, 0);
+  while (dbus_connection_dispatch(conn) == DBUS_DISPATCH_DATA_REMAINS)
+    ;
+}
+
+/* Idle dimming. The X server's IDLETIME system counter is watched with
+ * two SYNC alarms: one fires once the counter reaches the timeout, the
+ * other once it falls back below it (any input resets it to zero). Only
+ * one of them is active at a time and both are evaluated by the server,
+ * so nothing runs here while the user is active. */
+static int idle_dim_battery_ms = 0; // --dim-after-battery, 0 = off
+static int idle_dim_ac_ms = 0;      // --dim-after-ac, 0 = off
+static int idle_dim_pct = 30;       // --dim-level
+
+typedef struct {
+  bool available;
+  int event_base;
+  XSyncCounter counter;
+  XSyncAlarm idle_alarm;   // counter >= timeout
+  XSyncAlarm active_alarm; // counter < timeout, armed only while dimmed
+  int timeout_ms;          // currently armed timeout, 0 = disarmed
+  bool dimmed;
+  int saved_level; // raw level to restore
+} IdleDim;
+
+static IdleDim idle_dim;
+
+/* UPower reports the battery state; anything but draining it counts as AC */
+static int idle_timeout_for(const BatteryInfo *b) {
+  bool on_battery = b && b->valid && (b->state == 2 || b->state == 3 ||
+                                      b->state == 6);
+  return on_battery ? idle_dim_battery_ms : idle_dim_ac_ms;
+}
+
+static XSyncAlarm idle_set_alarm(Display *dpy, XSyncAlarm alarm,
+                                 XSyncTestType test, int64_t value) {
+  XSyncAlarmAttributes attr;
+  attr.trigger.counter = idle_dim.counter;
+  attr.trigger.value_type = XSyncAbsolute;
+  attr.trigger.test_type = test;
+  XSyncIntsToValue(&attr.trigger.wait_value, (unsigned int)value,
+                   (int)(value >> 32));
+  XSyncIntToValue(&attr.delta, 0); // one shot: inactive after firing
+  attr.events = True;
+  unsigned long mask = XSyncCACounter | XSyncCAValueType | XSyncCATestType |
+                       XSyncCAValue | XSyncCADelta | XSyncCAEvents;
+  if (alarm == None)
+    return XSyncCreateAlarm(dpy, mask, &attr);
+  XSyncChangeAlarm(dpy, alarm, mask, &attr); // also reactivates it
+  return alarm;
+}
+
+static bool idle_init(Display *dpy) {
+  if (idle_dim_battery_ms <= 0 && idle_dim_ac_ms <= 0)
+    return false;
+  int error_base, major, minor;
+  if (!XSyncQueryExtension(dpy, &idle_dim.event_base, &error_base) ||
+      !XSyncInitialize(dpy, &major, &minor)) {
+    fprintf(stderr, "X SYNC extension unavailable; idle dimming disabled\n");
+    return false;
+  }
+  int ncounters = 0;
+  XSyncSystemCounter *counters = XSyncListSystemCounters(dpy, &ncounters);
+  for (int i = 0; i < ncounters; ++i) {
+    if (strcmp(counters[i].name, "IDLETIME") == 0) {
+      idle_dim.counter = counters[i].counter;
+      idle_dim.available = true;
+      break;
+    }
+  }
+  if (counters)
+    XSyncFreeSystemCounterList(counters);
+  if (!idle_dim.available)
+    fprintf(stderr, "No IDLETIME counter; idle dimming disabled\n");
+  return idle_dim.available;
+}
+
+/* (re)arm the idle alarm for the current power source */
+static void idle_arm(Display *dpy, const BatteryInfo *b) {
+  if (!idle_dim.available)
+    return;
+  int ms = idle_timeout_for(b);
+  if (ms == idle_dim.timeout_ms)
+    return;
+  idle_dim.timeout_ms = ms;
+  if (ms <= 0) {
+    if (idle_dim.idle_alarm != None) {
+      XSyncDestroyAlarm(dpy, idle_dim.idle_alarm);
+      idle_dim.idle_alarm = None;
+    }
+    return;
+  }
+  // while dimmed only the wake-up alarm matters; it is rearmed on restore
+  if (!idle_dim.dimmed)
+    idle_dim.idle_alarm = idle_set_alarm(dpy, idle_dim.idle_alarm,
+                                         XSyncPositiveComparison, ms);
+}
+
+static void idle_dim_now(Display *dpy, DBusConnection *conn) {
+  BrightnessInfo cur = {0};
+  if (read_brightness(&cur) && cur.valid) {
+    int target = (int)((double)cur.max * idle_dim_pct / 100.0 + 0.5);
+    if (target < cur.level && set_brightness_via_service(conn, target)) {
+      idle_dim.saved_level = cur.level;
+      idle_dim.dimmed = true;
+    }
+  }
+  // even when nothing was dimmed (already dark enough, or the write
+  // failed), wait for input before arming the next idle period
+  idle_dim.active_alarm =
+      idle_set_alarm(dpy, idle_dim.active_alarm, XSyncNegativeComparison,
+                     idle_dim.timeout_ms);
+}
+
+static void idle_restore(DBusConnection *conn) {
+  if (!idle_dim.dimmed)
     return;
+  set_brightness_via_service(conn, idle_dim.saved_level);
+  idle_dim.dimmed = false;
+}
+
+/* handle an alarm notification; returns true if the event was one of ours.
+ * *brightness_changed is set when the backlight was written. */
+static bool idle_handle_event(Display *dpy, DBusConnection *conn,
+                              const XEvent *e, bool *brightness_changed) {
+  if (!idle_dim.available ||
+      e->type != idle_dim.event_base + XSyncAlarmNotify)
+    return false;
+  const XSyncAlarmNotifyEvent *ae = (const XSyncAlarmNotifyEvent *)e;
+  if (ae->state == XSyncAlarmDestroyed)
+    return true;
+  if (ae->alarm == idle_dim.idle_alarm && idle_dim.timeout_ms > 0 &&
+      !idle_dim.dimmed) {
+    idle_dim_now(dpy, conn);
+    if (idle_dim.dimmed)
+      *brightness_changed = true;
+  } else if (ae->alarm == idle_dim.active_alarm) {
+    if (idle_dim.dimmed) {
+      idle_restore(conn);
+      *brightness_changed = true;
+    }
+    if (idle_dim.timeout_ms > 0)
+      idle_dim.idle_alarm = idle_set_alarm(
+          dpy, idle_dim.idle_alarm, XSyncPositiveComparison,
+          idle_dim.timeout_ms);
+  }
+  return true;
+}
+
+/* Notifications normally go to a long-lived x11notif over a Unix
+ * SOCK_SEQPACKET socket, one packet per message:
+ *
+ *   NotifWireHeader, followed by `len` bytes of UTF-8 text (no NUL)
+ *
+ * Only when nothing is listening do we fall back to spawning x11notif. */
+#define NOTIF_WIRE_MAGIC 0x4e58 // "XN"
+#define NOTIF_WIRE_VERSION 1
+#define NOTIF_TEXT_MAX 512
+#define NOTIF_QUEUE_MAX 8
+
+typedef struct {
+  uint16_t magic;
+  uint8_t version;
+  uint8_t urgency; // NotifUrgency
+  uint32_t len;
+} NotifWireHeader;
+
+typedef struct {
+  size_t len;
+  unsigned char data[sizeof(NotifWireHeader) + NOTIF_TEXT_MAX];
+} NotifFrame;
+
+typedef struct {
+  int fd; // -1 while disconnected; connected lazily
+  // frames the socket could not take yet, flushed on POLLOUT
+  NotifFrame queue[NOTIF_QUEUE_MAX];
+  int head;
+  int count;
+} NotifClient;
+
+static NotifClient notif_client = {.fd = -1};
+
+static bool notif_socket_path(char *out, size_t n) {
+  const char *dir = getenv("XDG_RUNTIME_DIR");
+  int len;
+  if (dir && *dir)
+    len = snprintf(out, n, "%s/x11notif.sock", dir);
+  else
+    len = snprintf(out, n, "/tmp/x11notif-%u.sock", (unsigned)getuid());
+  return len > 0 && (size_t)len < n;
+}
+
+static void notif_disconnect(void) {
+  if (notif_client.fd >= 0)
+    close(notif_client.fd);
+  notif_client.fd = -1;
+  notif_client.count = 0;
+  notif_client.head = 0;
+}
+
+static bool notif_connect(void) {
+  if (notif_client.fd >= 0)
+    return true;
+  struct sockaddr_un addr = {0};
+  addr.sun_family = AF_UNIX;
+  if (!notif_socket_path(addr.sun_path, sizeof addr.sun_path))
+    return false;
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return false;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof addr) < 0) {
+    close(fd);
+    return false;
+  }
+  notif_client.fd = fd;
+  return true;
+}
+
+/* 1 = sent, 0 = would block, -1 = connection is gone */
+static int notif_send_frame(const NotifFrame *f) {
+  ssize_t n = send(notif_client.fd, f->data, f->len,
+                   MSG_DONTWAIT | MSG_NOSIGNAL);
+  if (n == (ssize_t)f->len)
+    return 1;
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS))
+    return 0;
+  return -1;
+}
+
+static void notif_flush(void) {
+  while (notif_client.count > 0) {
+    int rc = notif_send_frame(&notif_client.queue[notif_client.head]);
+    if (rc == 0)
+      return;
+    if (rc < 0) {
+      fprintf(stderr, "x11notif socket lost, %d notifications dropped\n",
+              notif_client.count);
+      notif_disconnect();
+      return;
+    }
+    notif_client.head = (notif_client.head + 1) % NOTIF_QUEUE_MAX;
+    --notif_client.count;
+  }
+}
+
+/* hand a message to the notifier daemon without blocking; false if there
+ * is no daemon to take it */
+static bool notif_deliver(const char *msg, NotifUrgency urgency) {
+  NotifFrame f;
+  size_t len = strnlen(msg, NOTIF_TEXT_MAX);
+  NotifWireHeader hdr = {.magic = NOTIF_WIRE_MAGIC,
+                         .version = NOTIF_WIRE_VERSION,
+                         .urgency = (uint8_t)urgency,
+                         .len = (uint32_t)len};
+  memcpy(f.data, &hdr, sizeof hdr);
+  memcpy(f.data + sizeof hdr, msg, len);
+  f.len = sizeof hdr + len;
+
+  // a daemon restart leaves us with a dead socket; reconnect once
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    if (!notif_connect())
+      return false;
+    if (notif_client.count == 0) {
+      int rc = notif_send_frame(&f);
+      if (rc > 0)
+        return true;
+      if (rc < 0) {
+        notif_disconnect();
+        continue;
+      }
+    }
+    if (notif_client.count >= NOTIF_QUEUE_MAX)
+      return false;
+    int tail = (notif_client.head + notif_client.count) % NOTIF_QUEUE_MAX;
+    notif_client.queue[tail] = f;
+    ++notif_client.count;
+    return true;
+  }
+  return false;
+}
+
+static void spawn_notifier(const char *msg) {
   pid_t pid = fork();
   if (pid < 0) {
     return; // fork failed
@@ -2026,51 +4467,65 @@ static void send_notification(const char *msg) {
   waitpid(pid, &status, 0);
 }
 
+static void send_notification(const char *msg, NotifUrgency urgency) {
+  if (!msg)
+    return;
+  if (!notif_deliver(msg, urgency))
+    spawn_notifier(msg);
+}
+
 static int threshold_15_signalled = 0;
 static int threshold_5_signalled = 0;
 
 static void check_and_notify(const BatteryInfo *prev, const BatteryInfo *cur,
                              bool notify_enabled) {
   if (!notify_enabled) return;
-  if (!cur || !cur->valid) { printf("Not notifying (1).\n"); return; }
-  if (!prev || !prev->valid) { printf("Not notifying (2).\n"); return; }
+  if (!cur || !cur->valid) {
+    fprintf(stderr, "Not notifying (1).\n");
+    return;
+  }
+  if (!prev || !prev->valid) {
+    fprintf(stderr, "Not notifying (2).\n");
+    return;
+  }
 
   char eta[64];
 
   // If ETA changed from unknown to known, notify about the newly-known time.
-  // Unknown ETA is represented by <= 0 in tte/ttf.
-  if (prev->valid && cur->valid) {
+  // Unknown ETA is represented by <= 0. A state change already announces
+  // its ETA below.
+  if (prev->valid && cur->valid && prev->state == cur->state) {
     // Discharging: TTE became known
-    if ((prev->tte <= 0) && (cur->tte > 0) && cur->state == 2) {
-      fmt_eta(eta, sizeof eta, cur->state, cur->tte, cur->ttf);
+    if ((prev->eta <= 0) && (cur->eta > 0) && cur->state == 2) {
+      fmt_eta(eta, sizeof eta, cur->eta);
       char msg[256];
       snprintf(msg, sizeof msg, "Battery ETA: %s left (%.1f%%)", eta, cur->percentage);
-      send_notification(msg);
+      send_notification(msg, NOTIF_NORMAL);
     }
     // Charging: TTF became known
-    if ((prev->ttf <= 0) && (cur->ttf > 0) && cur->state == 1) {
-      fmt_eta(eta, sizeof eta, cur->state, cur->tte, cur->ttf);
+    if ((prev->eta <= 0) && (cur->eta > 0) && cur->state == 1) {
+      fmt_eta(eta, sizeof eta, cur->eta);
       char msg[256];
       snprintf(msg, sizeof msg, "Battery to full: %s (%.1f%%)", eta, cur->percentage);
-      send_notification(msg);
+      send_notification(msg, NOTIF_NORMAL);
     }
   }
 
   // 1) Low battery thresholds (15% and 5%) when discharging.
   // Shitty, but who's gonna do it better?
   if (cur->percentage <= 15 && threshold_15_signalled == 0) {
-    fmt_eta(eta, sizeof eta, cur->state, cur->tte, cur->ttf);
+    fmt_eta(eta, sizeof eta, cur->eta);
     char msg[256];
     snprintf(msg, sizeof msg, "Battery low: %.0f%% (ETA %s)", cur->percentage, eta);
-    send_notification(msg);
+    send_notification(msg, NOTIF_CRITICAL);
     threshold_15_signalled = 1;
   }
 
   if (cur->percentage <= 5 && threshold_5_signalled == 0) {
-    fmt_eta(eta, sizeof eta, cur->state, cur->tte, cur->ttf);
+    fmt_eta(eta, sizeof eta, cur->eta);
     char msg[256];
     snprintf(msg, sizeof msg, "Battery low: %.0f%% (ETA %s)", cur->percentage, eta);
-    send_notification(msg);
+    send_notification(msg, NOTIF_CRITICAL);
     threshold_5_signalled = 1;
   }
 
@@ -2081,33 +4536,231 @@ static void check_and_notify(const BatteryInfo *prev, const BatteryInfo *cur,
   if (cur->state == 4 && prev->state != 4) {
     char msg[128];
     snprintf(msg, sizeof msg, "Battery fully charged: %.0f%%", cur->percentage);
-    send_notification(msg);
+    send_notification(msg, NOTIF_NORMAL);
   }
 
   // 3) Discharging started
   if (cur->state == 2 && prev->state != 2) {
-    fmt_eta(eta, sizeof eta, cur->state, cur->tte, cur->ttf);
+    fmt_eta(eta, sizeof eta, cur->eta);
     char msg[256];
     snprintf(msg, sizeof msg, "Battery discharging: %.1f%% (ETA %s)", cur->percentage, eta);
-    send_notification(msg);
+    send_notification(msg, NOTIF_NORMAL);
   }
 
   // 4) Charging started
   if (cur->state == 1 && prev->state != 1) {
-    fmt_eta(eta, sizeof eta, cur->state, cur->tte, cur->ttf);
+    fmt_eta(eta, sizeof eta, cur->eta);
     char msg[256];
     snprintf(msg, sizeof msg, "Battery charging: %.1f%% (ETA %s)", cur->percentage, eta);
-    send_notification(msg);
+    send_notification(msg, NOTIF_NORMAL);
+  }
+}
+
+/* Headless mode: one JSON object per line on stdout. A record is built in
+ * a preallocated buffer smaller than PIPE_BUF and goes out in a single
+ * write(), so readers of a pipe never see partial lines. */
+#define JSON_RECORD_MAX 1024
+
+typedef struct {
+  char *buf;
+  size_t len, cap;
+  bool overflow;
+} JsonOut;
+
+static void json_printf(JsonOut *o, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void json_printf(JsonOut *o, const char *fmt, ...) {
+  if (o->overflow)
+    return;
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(o->buf + o->len, o->cap - o->len, fmt, ap);
+  va_end(ap);
+  if (n < 0 || (size_t)n >= o->cap - o->len)
+    o->overflow = true;
+  else
+    o->len += (size_t)n;
+}
+
+static void json_string(JsonOut *o, const char *str) {
+  json_printf(o, "\"");
+  for (const unsigned char *p = (const unsigned char *)str; *p; ++p) {
+    if (*p == '"' || *p == '\\')
+      json_printf(o, "\\%c", *p);
+    else if (*p < 0x20)
+      json_printf(o, "\\u%04x", *p);
+    else
+      json_printf(o, "%c", *p);
   }
+  json_printf(o, "\"");
+}
+
+static void json_number(JsonOut *o, const char *key, bool have, double v) {
+  if (have)
+    json_printf(o, "\"%s\":%.1f", key, v);
+  else
+    json_printf(o, "\"%s\":null", key);
+}
+
+/* emit a record if anything changed since the last one, or if `force`;
+ * returns true if a line was written */
+static bool headless_emit(const BatteryInfo *b, const CpuInfo *cpu,
+                          const BrightnessInfo *brightness,
+                          const GovernorInfo *governor, bool force) {
+  static char buf[JSON_RECORD_MAX];
+  static char last[JSON_RECORD_MAX];
+  static size_t last_len = 0;
+
+  JsonOut o = {.buf = buf, .cap = sizeof buf};
+  json_printf(&o, "{\"battery\":");
+  if (b->valid)
+    json_printf(&o,
+                "{\"percentage\":%.1f,\"energy_rate\":%.2f,\"state\":%u,"
+                "\"tte\":%lld,\"ttf\":%lld,\"eta\":%lld}",
+                b->percentage, b->energy_rate, b->state, (long long)b->tte,
+                (long long)b->ttf, (long long)b->eta);
+  else
+    json_printf(&o, "null");
+  json_printf(&o, ",\"cpu\":{");
+  json_number(&o, "frequency_mhz", cpu->have_freq, cpu->frequency_mhz);
+  json_printf(&o, ",");
+  json_number(&o, "temperature_c", cpu->have_temp, cpu->temperature_c);
+  json_printf(&o, ",");
+  json_number(&o, "fan_rpm", cpu->have_fan, cpu->fan_rpm);
+  json_printf(&o, "},\"brightness\":");
+  if (brightness->valid)
+    json_printf(&o, "{\"level\":%d,\"max\":%d}", brightness->level,
+                brightness->max);
+  else
+    json_printf(&o, "null");
+  json_printf(&o, ",\"governor\":");
+  if (governor->valid)
+    json_string(&o, governor->name);
+  else
+    json_printf(&o, "null");
+  if (o.overflow)
+    return false;
+
+  // the timestamp is appended after the comparison
+  size_t body_len = o.len;
+  if (!force && body_len == last_len && memcmp(buf, last, body_len) == 0)
+    return false;
+  memcpy(last, buf, body_len);
+  last_len = body_len;
+
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  json_printf(&o, ",\"time\":%lld.%03ld}\n", (long long)ts.tv_sec,
+              ts.tv_nsec / 1000000);
+  if (o.overflow)
+    return false;
+  ssize_t w;
+  do {
+    w = write(STDOUT_FILENO, buf, o.len);
+  } while (w < 0 && errno == EINTR);
+  return w == (ssize_t)o.len;
+}
+
+/* value of a "--name=value" argument, or NULL if `arg` is not `prefix` */
+static const char *opt_value(const char *arg, const char *prefix) {
+  size_t n = strlen(prefix);
+  return strncmp(arg, prefix, n) == 0 ? arg + n : NULL;
+}
+
+/* whole seconds, at most a day, as milliseconds */
+static bool parse_seconds_ms(const char *val, int *out_ms) {
+  char *end = NULL;
+  long sec = strtol(val, &end, 10);
+  if (end == val || *end || sec < 0 || sec > 86400)
+    return false;
+  *out_ms = (int)sec * 1000;
+  return true;
 }
 
 int main(int argc, char **argv) {
   bool notify_enabled = false;
+  bool headless = false;
+  int sample_ms = SENSOR_POLL_MS;
+  int heartbeat_ms = 0;
   for (int i = 1; i < argc; ++i) {
+    const char *val;
     if (strcmp(argv[i], "--notifications") == 0) {
       notify_enabled = true;
-    } else if (strncmp(argv[i], "--powersave-threshold=", 23) == 0) {
-      const char *val = argv[i] + 23;
+    } else if (strcmp(argv[i], "--headless") == 0) {
+      headless = true;
+    } else if ((val = opt_value(argv[i], "--interval=")) != NULL) {
+      char *end = NULL;
+      long ms = strtol(val, &end, 10);
+      if (end == val || *end || ms < 10 || ms > 3600000) {
+        fprintf(stderr, "--interval expects milliseconds (10..3600000)\n");
+        return 1;
+      }
+      sample_ms = (int)ms;
+    } else if ((val = opt_value(argv[i], "--heartbeat=")) != NULL) {
+      if (!parse_seconds_ms(val, &heartbeat_ms)) {
+        fprintf(stderr, "Invalid value for --heartbeat\n");
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--psi-notify") == 0) {
+      psi_notify_enabled = true;
+    } else if ((val = opt_value(argv[i], "--top=")) != NULL) {
+      char *end = NULL;
+      long n = strtol(val, &end, 10);
+      if (end == val || *end || n < 1 || n > TOP_MAX) {
+        fprintf(stderr, "--top expects a number between 1 and %d\n",
+                TOP_MAX);
+        return 1;
+      }
+      top_n = (int)n;
+      top_shown = true;
+    } else if ((val = opt_value(argv[i], "--dim-after-battery=")) != NULL) {
+      if (!parse_seconds_ms(val, &idle_dim_battery_ms)) {
+        fprintf(stderr, "Invalid value for --dim-after-battery\n");
+        return 1;
+      }
+    } else if ((val = opt_value(argv[i], "--dim-after-ac=")) != NULL) {
+      if (!parse_seconds_ms(val, &idle_dim_ac_ms)) {
+        fprintf(stderr, "Invalid value for --dim-after-ac\n");
+        return 1;
+      }
+    } else if ((val = opt_value(argv[i], "--dim-level=")) != NULL) {
+      char *end = NULL;
+      long pct = strtol(val, &end, 10);
+      if (end == val || (*end && strcmp(end, "%") != 0) || pct < 0 ||
+          pct > 100) {
+        fprintf(stderr, "--dim-level expects a percentage\n");
+        return 1;
+      }
+      idle_dim_pct = (int)pct;
+    } else if ((val = opt_value(argv[i], "--sysfs-root=")) != NULL) {
+      if (!val[0] || strlen(val) >= sizeof sysfs_root - 64) {
+        fprintf(stderr, "Invalid value for --sysfs-root\n");
+        return 1;
+      }
+      snprintf(sysfs_root, sizeof sysfs_root, "%s", val);
+    } else if (strcmp(argv[i], "--bench") == 0) {
+      bench_enabled = true;
+    } else if ((val = opt_value(argv[i], "--bench=")) != NULL) {
+      char *end = NULL;
+      long ms = strtol(val, &end, 10);
+      if (end == val || *end || ms < 1000 || ms > 3600000) {
+        fprintf(stderr, "--bench expects a report period in milliseconds "
+                        "(1000..3600000)\n");
+        return 1;
+      }
+      bench_enabled = true;
+      bench_period_ms = ms;
+    } else if ((val = opt_value(argv[i], "--powercap-root=")) != NULL) {
+      if (!val[0] || strlen(val) >= sizeof powercap_root) {
+        fprintf(stderr, "Invalid value for --powercap-root\n");
+        return 1;
+      }
+      snprintf(powercap_root, sizeof powercap_root, "%s", val);
+    } else if ((val = opt_value(argv[i], "--policy=")) != NULL) {
+      if (!policy_load(val))
+        return 1;
+    } else if ((val = opt_value(argv[i], "--powersave-threshold=")) != NULL) {
       if (!val[0]) {
         fprintf(stderr, "Empty value for --powersave-threshold\n");
         return 1;
@@ -2134,8 +4787,14 @@ int main(int argc, char **argv) {
         fprintf(stderr, "Threshold must be between 0 and 100\n");
         return 1;
       }
-      powersave_threshold = parsed;
-      powersave_threshold_enabled = true;
+      // shorthand for the rule the option has always meant
+      char rule[96], why[128];
+      snprintf(rule, sizeof rule, "percentage <= %g ~0 -> governor powersave",
+               parsed);
+      if (!policy_add_rule(rule, why, sizeof why)) {
+        fprintf(stderr, "--powersave-threshold: %s\n", why);
+        return 1;
+      }
     }
   }
   // D-Bus setup
@@ -2148,45 +4807,83 @@ int main(int argc, char **argv) {
   char dev_path[256] = {0};
   if (!get_display_device_path(conn, dev_path, sizeof dev_path)) {
     fprintf(stderr, "Failed to get DisplayDevice path\n");
-    return 1;
+    if (!headless)
+      return 1;
+    // servers often run without UPower; pick it up if it ever starts
+    snprintf(dev_path, sizeof dev_path, "%s", UPOWER_DISPLAY_PATH);
   }
 
   BatteryInfo b = {0};
   CpuInfo cpu = {0};
+  PowerInfo power = {0};
   BrightnessInfo brightness = {0};
   if (!fetch_props(conn, dev_path, &b)) {
     fprintf(stderr, "Failed to fetch initial properties\n");
     // continue anyway; window will show "No battery data"
   }
+  BatteryInfo none = {0};
+  rate_observe(&none, &b);
+  b.eta = battery_eta(&b);
+  discover_sensors();
+  discover_batteries();
   read_cpu_info(&cpu);
+  open_psi();
+  discover_rapl();
+  for (int i = 0; i < PSI_COUNT; ++i)
+    read_psi(&psi[i]);
   read_brightness(&brightness);
   query_governor_info(&governor_info);
 
-  if (powersave_threshold_enabled) {
-    if (handle_powersave_threshold(conn, &b))
-      query_governor_info(&governor_info);
+  if (policy_update(conn, &b, &cpu)) {
+    query_governor_info(&governor_info);
+    read_brightness(&brightness);
   }
 
-  // Subscribe to PropertiesChanged
+  // One PropertiesChanged match covers every UPower device; the filter
+  // dispatches on the object path.
   char match[512];
   snprintf(match, sizeof match,
-           "type='signal',interface='%s',member='PropertiesChanged',path='%s'",
-           DBUS_PROP_IF, dev_path);
+           "type='signal',sender='%s',interface='%s',"
+           "member='PropertiesChanged',arg0='%s'",
+           UPOWER_BUS, DBUS_PROP_IF, UPOWER_DEV_IF);
   dbus_bus_add_match(conn, match, &err);
   dbus_connection_flush(conn);
   if (!dbus_check(&err, "add_match")) { /* keep going without signals */
   }
 
+  snprintf(match, sizeof match,
+           "type='signal',sender='%s',interface='%s',path='%s'", UPOWER_BUS,
+           UPOWER_IFACE, UPOWER_PATH);
+  dbus_bus_add_match(conn, match, &err);
+  dbus_check(&err, "add_match DeviceAdded/DeviceRemoved");
+
+  // Signals are the source of truth; a full resync only happens when the
+  // service itself goes away and comes back.
+  snprintf(match, sizeof match,
+           "type='signal',sender='%s',interface='%s',"
+           "member='NameOwnerChanged',arg0='%s'",
+           DBUS_SERVICE_DBUS, DBUS_INTERFACE_DBUS, UPOWER_BUS);
+  dbus_bus_add_match(conn, match, &err);
+  dbus_check(&err, "add_match NameOwnerChanged");
+
   bool dirty = true;
-  SignalCtx sctx = {.b = &b, .dev_path = dev_path, .dirty = &dirty};
+  bool rows_dirty = false;
+  SignalCtx sctx = {.conn = conn,
+                    .b = &b,
+                    .dev_path = dev_path,
+                    .dirty = &dirty,
+                    .rows_dirty = &rows_dirty};
   dbus_connection_add_filter(conn, signal_filter, &sctx, NULL);
+  enumerate_devices(&sctx);
 
   // X11 UI
-  Ui ui;
-  if (!ui_init(&ui))
-    return 1;
+  Ui ui = {0};
+  if (!headless) {
+    if (!ui_init(&ui))
+      return 1;
+    if (idle_init(ui.dpy))
+      idle_arm(ui.dpy, &b);
 
-  {
     Window root = RootWindow(ui.dpy, ui.screen);
     KeyCode kc_up = XKeysymToKeycode(ui.dpy, XF86XK_MonBrightnessUp);
     KeyCode kc_down = XKeysymToKeycode(ui.dpy, XF86XK_MonBrightnessDown);
@@ -2197,22 +4894,63 @@ int main(int argc, char **argv) {
       XGrabKey(ui.dpy, kc_down, AnyModifier, root, True, GrabModeAsync, GrabModeAsync);
     }
   }
+  struct timespec last_emit = {0, 0};
 
   BatteryInfo prev = b; // copy initial state to avoid spurious notifications
   struct timespec last_cpu_poll = {0, 0};
   struct timespec last_brightness_poll = {0, 0};
   struct timespec last_governor_poll = {0, 0};
 
+  // Let the kernel batch whatever timers remain with other wakeups.
+  if (prctl(PR_SET_TIMERSLACK, TIMER_SLACK_NS, 0, 0, 0) != 0)
+    perror("prctl(PR_SET_TIMERSLACK)");
+
   // Main loop
-  struct timespec last_poll = (struct timespec){0, 0};
-  const int xfd = ConnectionNumber(ui.dpy);
+  enum {
+    PFD_X,
+    PFD_DBUS,
+    PFD_UEVENT,
+    PFD_NOTIF,
+    PFD_SIGNAL, // SIGUSR1 self-pipe
+    PFD_PSI,    // PSI_COUNT entries
+    PFD_COUNT = PFD_PSI + PSI_COUNT
+  };
+  struct pollfd pfds[PFD_COUNT];
+  pfds[PFD_X] = (struct pollfd){
+      .fd = headless ? -1 : ConnectionNumber(ui.dpy), .events = POLLIN};
+  int dbus_fd = -1;
+  if (!dbus_connection_get_unix_fd(conn, &dbus_fd))
+    dbus_fd = -1;
+  pfds[PFD_DBUS] = (struct pollfd){.fd = dbus_fd, .events = POLLIN};
+  pfds[PFD_UEVENT] =
+      (struct pollfd){.fd = open_uevent_socket(), .events = POLLIN};
+  pfds[PFD_NOTIF] = (struct pollfd){.fd = -1};
+  pfds[PFD_SIGNAL] =
+      (struct pollfd){.fd = stats_install_signal(), .events = POLLIN};
+  for (int i = 0; i < PSI_COUNT; ++i)
+    pfds[PFD_PSI + i] = (struct pollfd){.fd = psi[i].fd, .events = POLLPRI};
+  struct timespec last_psi_poll = {0, 0};
+  struct timespec last_top_poll = {0, 0};
+  // Headless there is nothing to hide; everything is always sampled.
+  bool visible = headless || ui_visible(&ui);
 
   for (;;) {
-    dbus_connection_read_write_dispatch(conn, 0); // one pass is enough
+    stat_count(STAT_LOOPS);
+    dbus_drain(conn);
 
-    while (XPending(ui.dpy)) {
+    while (!headless && XPending(ui.dpy)) {
       XEvent e;
       XNextEvent(ui.dpy, &e);
+      if (ui_track_visibility(&ui, &e))
+        continue;
+      bool dimmed_or_restored = false;
+      if (idle_handle_event(ui.dpy, conn, &e, &dimmed_or_restored)) {
+        if (dimmed_or_restored) {
+          last_brightness_poll = (struct timespec){0, 0};
+          brightness.valid = false;
+        }
+        continue;
+      }
       switch (e.type) {
       case Expose:
         if (e.xexpose.count == 0)
@@ -2269,6 +5007,23 @@ int main(int argc, char **argv) {
           break;
         }
 
+        if (sym == XK_s) {
+          stats_shown = !stats_shown;
+          dirty = true;
+          break;
+        }
+
+        if (sym == XK_t && top_n > 0) {
+          top_shown = !top_shown;
+          reset_top();
+          last_top_poll = (struct timespec){0, 0};
+          dirty = true;
+          break;
+        }
+
+        // Brightness is not polled while hidden; step from a fresh value.
+        if (!ui_visible(&ui))
+          brightness.valid = false;
         bool handled = false;
         if (sym == XF86XK_MonBrightnessUp)
           handled = adjust_brightness(+1, &brightness, conn);
@@ -2315,108 +5070,249 @@ int main(int argc, char **argv) {
       }
     }
 
+    // Coming back into view: refresh everything that was suspended.
+    bool now_visible = headless || ui_visible(&ui);
+    if (now_visible && !visible) {
+      reset_power_window();
+      reset_top();
+      last_top_poll = (struct timespec){0, 0};
+      last_cpu_poll = (struct timespec){0, 0};
+      last_brightness_poll = (struct timespec){0, 0};
+      last_governor_poll = (struct timespec){0, 0};
+      dirty = true;
+    }
+    visible = now_visible;
+
     struct timespec now;
     clock_gettime(CLOCK_MONOTONIC, &now);
-
-    bool cpu_due = false;
-    if (last_cpu_poll.tv_sec == 0 && last_cpu_poll.tv_nsec == 0)
-      cpu_due = true;
-    else {
-      time_t sec = now.tv_sec - last_cpu_poll.tv_sec;
-      long nsec = now.tv_nsec - last_cpu_poll.tv_nsec;
-      if (sec > 2 || (sec == 2 && nsec >= 0))
-        cpu_due = true;
-    }
-    if (cpu_due) {
-      CpuInfo updated = {0};
-      read_cpu_info(&updated);
-      if (!cpu_info_equal(&cpu, &updated))
-        dirty = true;
-      cpu = updated;
-      last_cpu_poll = now;
+    int timeout = -1;
+
+    // Sensors, brightness and governor only feed the display, so they are
+    // not sampled at all while the window cannot be seen, unless a policy
+    // rule watches the temperature.
+    if (!visible && policy_needs_temperature()) {
+      if (ms_until_due(&last_cpu_poll, &now, sample_ms) == 0) {
+        CpuInfo updated = {0};
+        read_cpu_info(&updated);
+        if (!cpu_info_equal(&cpu, &updated))
+          dirty = true;
+        else
+          stat_count(STAT_SKIP_CPU);
+        cpu = updated;
+        last_cpu_poll = now;
+      }
+      timeout_min(&timeout, ms_until_due(&last_cpu_poll, &now, sample_ms));
     }
+    if (visible) {
+      if (ms_until_due(&last_cpu_poll, &now, sample_ms) == 0) {
+        CpuInfo updated = {0};
+        read_cpu_info(&updated);
+        if (!cpu_info_equal(&cpu, &updated))
+          dirty = true;
+        else
+          stat_count(STAT_SKIP_CPU);
+        cpu = updated;
+        PowerInfo pw = {0};
+        read_power(&pw, &now);
+        if (!power_info_equal(&power, &pw))
+          dirty = true;
+        else
+          stat_count(STAT_SKIP_POWER);
+        power = pw;
+        rate_sample_sysfs(&now);
+        if (battery_eta(&b) / 60 != b.eta / 60) // shown in minutes
+          dirty = true;
+        last_cpu_poll = now;
+      }
 
-    bool brightness_due = false;
-    if (last_brightness_poll.tv_sec == 0 && last_brightness_poll.tv_nsec == 0)
-      brightness_due = true;
-    else {
-      time_t sec = now.tv_sec - last_brightness_poll.tv_sec;
-      long nsec = now.tv_nsec - last_brightness_poll.tv_nsec;
-      if (sec > 2 || (sec == 2 && nsec >= 0))
-        brightness_due = true;
-    }
-    if (brightness_due) {
-      BrightnessInfo updated = {0};
-      if (read_brightness(&updated)) {
-        if (!brightness_equal(&brightness, &updated))
+      if (ms_until_due(&last_brightness_poll, &now, sample_ms) == 0) {
+        BrightnessInfo updated = {0};
+        if (read_brightness(&updated)) {
+          if (!brightness_equal(&brightness, &updated))
+            dirty = true;
+          else
+            stat_count(STAT_SKIP_BRIGHTNESS);
+          brightness = updated;
+        } else {
+          if (brightness.valid) {
+            BrightnessInfo cleared = {0};
+            brightness = cleared;
+            dirty = true;
+          }
+        }
+        last_brightness_poll = now;
+      }
+
+      if (ms_until_due(&last_governor_poll, &now, sample_ms) == 0) {
+        GovernorInfo updated = {0};
+        query_governor_info(&updated);
+        if (!governor_info_equal(&governor_info, &updated)) {
+          governor_info = updated;
           dirty = true;
-        brightness = updated;
-      } else {
-        if (brightness.valid) {
-          BrightnessInfo cleared = {0};
-          brightness = cleared;
+        } else {
+          stat_count(STAT_SKIP_GOVERNOR);
+        }
+        last_governor_poll = now;
+      }
+
+      if (top_shown) {
+        if (ms_until_due(&last_top_poll, &now, sample_ms) == 0) {
+          sample_top(&now);
           dirty = true;
+          last_top_poll = now;
         }
+        timeout_min(&timeout,
+                    ms_until_due(&last_top_poll, &now, sample_ms));
       }
-      last_brightness_poll = now;
-    }
 
-    bool governor_due = false;
-    if (last_governor_poll.tv_sec == 0 && last_governor_poll.tv_nsec == 0)
-      governor_due = true;
-    else {
-      time_t sec = now.tv_sec - last_governor_poll.tv_sec;
-      long nsec = now.tv_nsec - last_governor_poll.tv_nsec;
-      if (sec > 2 || (sec == 2 && nsec >= 0))
-        governor_due = true;
-    }
-    if (governor_due) {
-      GovernorInfo updated = {0};
-      query_governor_info(&updated);
-      if (!governor_info_equal(&governor_info, &updated)) {
-        governor_info = updated;
-        dirty = true;
+      // PSI is event driven; follow-up reads only track the decay of a
+      // spike the triggers told us about
+      if (psi_elevated()) {
+        if (ms_until_due(&last_psi_poll, &now, sample_ms) == 0) {
+          for (int i = 0; i < PSI_COUNT; ++i)
+            read_psi(&psi[i]);
+          dirty = true;
+          last_psi_poll = now;
+        }
+        timeout_min(&timeout,
+                    ms_until_due(&last_psi_poll, &now, sample_ms));
       }
-      last_governor_poll = now;
+
+      timeout_min(&timeout,
+                  ms_until_due(&last_cpu_poll, &now, sample_ms));
+      timeout_min(&timeout,
+                  ms_until_due(&last_brightness_poll, &now, sample_ms));
+      timeout_min(&timeout,
+                  ms_until_due(&last_governor_poll, &now, sample_ms));
     }
+    expire_inflight(&sctx, &now, &timeout);
 
-    // Periodic poll fallback every 5s
-    if ((now.tv_sec - last_poll.tv_sec) >= 5) {
-      if (fetch_props(conn, dev_path, &b))
+    bool heartbeat_due = false;
+    if (headless && heartbeat_ms > 0) {
+      heartbeat_due = ms_until_due(&last_emit, &now, heartbeat_ms) == 0;
+      if (heartbeat_due)
         dirty = true;
-      last_poll = now;
     }
 
     if (dirty) {
+      b.eta = battery_eta(&b);
       // Check and send notifications based on transitions/thresholds
-      bool governor_changed = handle_powersave_threshold(conn, &b);
-      if (governor_changed) {
+      if (policy_update(conn, &b, &cpu)) {
         GovernorInfo updated = {0};
         query_governor_info(&updated);
         governor_info = updated;
         last_governor_poll = now;
+        last_brightness_poll = (struct timespec){0, 0};
       }
       check_and_notify(&prev, &b, notify_enabled);
-      ui_update_icon(&ui, &b);
-      ui_draw(&ui, &b, &cpu, &brightness, &governor_info);
-      XFlush(ui.dpy);
+      if (!headless && (b.state != prev.state || b.valid != prev.valid))
+        idle_arm(ui.dpy, &b); // battery and AC have separate timeouts
       // update previous snapshot
       prev = b;
+      if (headless) {
+        if (headless_emit(&b, &cpu, &brightness, &governor_info,
+                          heartbeat_due)) {
+          last_emit = now;
+          bench_frame(0);
+        }
+        rows_dirty = false;
+      } else if (visible) {
+        unsigned long first_request = NextRequest(ui.dpy);
+        ui_update_icon(&ui, &b);
+        uint64_t t0 = stat_now();
+        int need_h = ui_draw(&ui, &b, &cpu, &power, &brightness,
+                             &governor_info);
+        stat_record(STAT_UI_DRAW, t0);
+        stat_count(STAT_REDRAWS);
+        if (need_h < MIN_WIN_H)
+          need_h = MIN_WIN_H;
+        if (need_h != ui.win_h)
+          XResizeWindow(ui.dpy, ui.win, (unsigned)ui.win_w, (unsigned)need_h);
+        rows_dirty = false;
+        bench_end_frame(ui.dpy, first_request);
+      }
+      if (!headless)
+        XFlush(ui.dpy);
       dirty = false;
+    } else if (rows_dirty && visible && !headless) {
+      unsigned long first_request = NextRequest(ui.dpy);
+      ui_draw_changed_rows(&ui);
+      XFlush(ui.dpy);
+      rows_dirty = false;
+      bench_end_frame(ui.dpy, first_request);
+    }
+
+    if (bench_enabled) {
+      bench_end_pass();
+      if (ms_until_due(&bench.start, &now, bench_period_ms) == 0)
+        bench_report(&now);
+      timeout_min(&timeout, ms_until_due(&bench.start, &now, bench_period_ms));
     }
 
-    struct pollfd pfd = {.fd = xfd, .events = POLLIN, .revents = 0};
-    int rc = poll(&pfd, 1, 1000);
+    // Work may have been queued behind our back by blocking round trips.
+    if (headless && heartbeat_ms > 0)
+      timeout_min(&timeout, ms_until_due(&last_emit, &now, heartbeat_ms));
+    if ((!headless && XEventsQueued(ui.dpy, QueuedAlready) > 0) ||
+        dbus_connection_get_dispatch_status(conn) ==
+            DBUS_DISPATCH_DATA_REMAINS)
+      timeout = 0;
+
+    // the notifier socket comes and goes; only wait on it with a backlog
+    pfds[PFD_NOTIF].fd = notif_client.count > 0 ? notif_client.fd : -1;
+    pfds[PFD_NOTIF].events = POLLOUT;
+
+    int rc = poll(pfds, PFD_COUNT, timeout);
+    ++bench.wakeups;
     if (rc < 0) {
       if (errno == EINTR)
         continue;
       perror("poll");
       break;
     }
+    if (rc == 0)
+      stat_count(STAT_WAKE_TIMEOUT);
+    if (pfds[PFD_X].revents)
+      stat_count(STAT_WAKE_X);
+    if (pfds[PFD_DBUS].revents)
+      stat_count(STAT_WAKE_DBUS);
+    if (rc > 0 && !pfds[PFD_X].revents && !pfds[PFD_DBUS].revents)
+      stat_count(STAT_WAKE_OTHER);
+    if (pfds[PFD_SIGNAL].revents & POLLIN) {
+      char drain[16];
+      while (read(pfds[PFD_SIGNAL].fd, drain, sizeof drain) > 0)
+        ;
+      stat_dump(stderr);
+    }
+    if (pfds[PFD_NOTIF].revents & (POLLERR | POLLHUP))
+      notif_disconnect();
+    else if (pfds[PFD_NOTIF].revents & POLLOUT)
+      notif_flush();
+    for (int i = 0; i < PSI_COUNT; ++i) {
+      short rev = pfds[PFD_PSI + i].revents;
+      if (rev & POLLERR) { // trigger gone; stop watching
+        close(psi[i].fd);
+        psi[i].fd = pfds[PFD_PSI + i].fd = -1;
+        psi[i].valid = false;
+        dirty = true;
+      } else if (rev & POLLPRI) {
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        read_psi(&psi[i]);
+        if (i == PSI_MEMORY)
+          psi_memory_stalled(&t);
+        last_psi_poll = t;
+        dirty = true;
+      }
+    }
+    if ((pfds[PFD_UEVENT].revents & POLLIN) &&
+        uevent_touches_hwmon(pfds[PFD_UEVENT].fd)) {
+      discover_sensors();
+      last_cpu_poll = (struct timespec){0, 0};
+    }
   }
 
 end:
-  if (powersave_threshold_enabled && powersave_active)
-    restore_governors(conn);
+  idle_restore(conn);
+  policy_apply(conn, true); // hand back whatever the policy overrode
   return 0;
 }